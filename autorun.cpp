@@ -1,149 +1,28 @@
-#include <sys/inotify.h>
-#include <sys/epoll.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <fts.h>
-#include <limits.h>
+#include <getopt.h>
 
-#include <iostream>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
-#include <cerrno>
+#include <iostream>
+#include <string>
 #include <vector>
-#include <functional>
-#include <getopt.h>
-#include <map>
 
+#include "compdb.h"
 #include "config.h"
-
-constexpr bool debug = DEBUG;
-
-void error(int rc, const char *msg)
-{
-    std::cerr << "autorun: " << msg << ": " << std::strerror(rc) << '\n';
-}
-
-void error(int rc, const std::string& msg)
-{
-    error(rc, msg.c_str());
-}
-
-class inotify {
-    public:
-        inotify() : _watches{}, _infd{}
-        {
-            _infd = inotify_init1(0);
-        }
-
-        bool add_watch(const std::string& filename)
-        {
-            return add_watch(filename.c_str());
-        }
-
-        bool add_watch(const char *filename)
-        {
-            int wd = inotify_add_watch(_infd, filename,
-                                       IN_MOVE | IN_MODIFY| IN_CREATE | IN_DELETE);
-            _watches[wd] = filename;
-            return wd >= 0;
-        }
-
-        int fd()
-        {
-            return _infd;
-        }
-
-        auto get_file(int wd) -> const std::string&
-        {
-            return _watches[wd];
-        }
-
-        ~inotify()
-        {
-            for (auto wd: _watches)
-                inotify_rm_watch(_infd, wd.first);
-
-            if (close(_infd) == -1)
-                error(errno, "close");
-        }
-
-    private:
-        std::map<int, std::string> _watches;
-        int _infd;
-};
-
-class epoll {
-    public:
-        using on_event_t = std::function<bool(struct epoll_event *)>;
-
-        epoll() : _efd{}
-        {
-            _efd = epoll_create1(0);
-        }
-
-        bool add(int fd)
-        {
-            struct epoll_event event;
-
-            event.data.fd = fd;
-            event.events = EPOLLIN | EPOLLOUT;
-
-            int rc = epoll_ctl(_efd, EPOLL_CTL_ADD, fd, &event);
-            if (rc)
-                error(errno, "epoll_ctl");
-
-            return rc == 0;
-        }
-
-        void wait(on_event_t cb)
-        {
-            struct epoll_event event[2];
-            bool running = true;
-            int rc = 0;
-
-            while (running) {
-                rc = epoll_wait(_efd, event, 2, -1);
-
-                if (rc == -1 && errno != EINTR) {
-                    error(errno, "epoll_wait");
-                    return;
-                } else if (errno == EINTR) {
-                    continue;
-                }
-
-                running = cb(event);
-            }
-        }
-
-    private:
-        int _efd;
-};
-
-void traverse(FTS *iter, inotify& in)
-{
-    FTSENT *file;
-
-    while ((file = fts_read(iter)) != nullptr) {
-        if constexpr (debug)
-            std::clog << iter->fts_path << '\n';
-
-        bool res = in.add_watch(iter->fts_path);
-        if (!res) {
-            auto msg = std::string{"inotify::add_watch "};
-            msg.append(iter->fts_path);
-            error(errno, msg);
-            return;
-        }
-    }
-
-    if (errno)
-        error(errno, "fts_read");
-}
-
-int run_cmd(const char *cmd)
-{
-    return system(cmd);
-}
+#include "depfile.h"
+#include "git.h"
+#include "jobs.h"
+#include "jobserver.h"
+#include "ninja.h"
+#include "pipeline.h"
+#include "pressure.h"
+#include "publisher.h"
+#include "rate.h"
+#include "tail.h"
+#include "trace.h"
+#include "util.h"
+#include "watcher.h"
+#include "worker.h"
 
 void version(const char *progname)
 {
@@ -159,44 +38,195 @@ void usage(const char *progname)
     --file|-f    name of the files whose events will trigger <cmd>
     --dir|-d     all events on files and directories inside <dirnames> will trigger <cmd>
                  (autorun will watch . by default)
+    --trace <file>
+                 record a binary trace, written to <file> on SIGUSR1 or on crash
+    --trace-size <n>
+                 number of trace records kept per thread (default: 4096)
+    --decode-trace <file>
+                 print the content of a trace file and exit
+    --record <file>
+                 save every event to <file> for a later --replay
+    --replay <file>
+                 run <cmd> for the events saved in <file> instead of watching
+    --speed <n>x replay <n> times faster than recorded (0: as fast as possible)
+    --shards <n> spread the watched subtrees over <n> inotify instances, each
+                 read by its own thread (default: 1)
+    --backend <inotify|fanotify|poll>
+                 how changes are detected (default: inotify)
+    --fork-server
+                 spawn <cmd> from a small helper process started before watching
+    --worker     keep <cmd> running and write each batch of changes to its stdin
+                 as a JSON line, <cmd> answers with a line on its stdout when done
+    --tail       keep <cmd> running and move the data appended to the changed
+                 files into its stdin, following rotated and truncated files
+    --match <regex>
+                 follow the files like --tail, but run <cmd> for each batch of
+                 appended lines matching the extended <regex>, with them on its stdin
+    --cache <dir>
+                 replay the output of earlier successful runs made with the same
+                 content in the watched files instead of running <cmd> again
+    --cache-size <MiB>
+                 size of the cache, least recently used results go first (default: 256)
+    --exclude <rule>
+                 ignore the changes to the paths matching <rule>: *.ext, *suffix,
+                 dir/ for a directory anywhere in the path, or a file name
+    --include <rule>
+                 only consider the changes to the paths matching one of the <rule>s
+    --job <priority>:<rules>:<cmd>
+                 run <cmd> when a change matches one of the comma separated <rules>,
+                 lower priorities first, from 10 on in the background: niced, with
+                 idle I/O priority and only while no other job waits
+    --preempt    stop the background job while a foreground job runs
+    --git        hold the changes while git checks out, merges or rebases, and do
+                 not watch the content of .git directories
+    --publish <name>
+                 instead of running a command, publish the changes in the shared
+                 memory feed /dev/shm/<name>, read with autorun/feed.h
+    --print-events[=nul]
+                 instead of running a command, print the changes on stdout as NDJSON,
+                 or as NUL terminated "<batch> <monotonic_ns> <type> <path>" records
+    --stage <name>:<rules>:<cmd>
+                 add a pipeline stage, stages run in order and stop at the first
+                 failure, a change restarts the pipeline from the first stage whose
+                 comma separated <rules> match, cancelling the running stage
+    --ninja <dir>
+                 watch the directories holding the inputs of the ninja build in <dir>
+                 and build the targets depending on the changed files, with <cmd>
+                 (default: ninja -C <dir>) followed by the targets
+    --compdb <file>
+                 watch the sources and headers of the compile_commands.json <file>
+                 and run the compile commands of the translation units they affect
+    --parallel <n>
+                 number of compiles run at once by --compdb (default: number of CPUs)
+    --depfiles <dir>
+                 watch the prerequisites listed in the *.d depfiles below <dir> and
+                 run <cmd> (default: make) followed by the targets depending on the
+                 changed files
+    --tests <map>
+                 only run the tests covering the changed files, as listed in <map>:
+                 "<test>: <file> <file>..." lines, they replace the {} of <cmd> or are
+                 appended to it
+    --jobserver <n>
+                 share <n> job slots between everything autorun runs through a make
+                 jobserver exported in MAKEFLAGS, --compdb compiles included
+    --pressure <percent>
+                 hold the changes while the CPU, memory or I/O pressure of the last
+                 10 seconds is above <percent>, for at most 30 seconds, with --job
+                 only the background jobs wait
+    --max-rate <n>/<period>[:<rules>]
+                 at most <n> runs per <period> (500ms, 5s, 1m...) for the changes
+                 matching one of the comma separated <rules>, or all of them, the
+                 changes over the limit are held until the next allowed run
     <cmd>        the command that will be run when an event is detected)"
     << '\n';
 }
 
+enum long_only_option {
+    opt_trace = 256,
+    opt_trace_size,
+    opt_decode_trace,
+    opt_record,
+    opt_replay,
+    opt_speed,
+    opt_shards,
+    opt_backend,
+    opt_fork_server,
+    opt_worker,
+    opt_cache,
+    opt_cache_size,
+    opt_exclude,
+    opt_include,
+    opt_job,
+    opt_preempt,
+    opt_git,
+    opt_publish,
+    opt_print_events,
+    opt_stage,
+    opt_ninja,
+    opt_compdb,
+    opt_parallel,
+    opt_depfiles,
+    opt_tests,
+    opt_jobserver,
+    opt_pressure,
+    opt_max_rate,
+    opt_tail,
+    opt_match,
+};
+
 constexpr struct option cmd_args[] = {
-    { "dir",     required_argument, nullptr, 'd', },
-    { "file",    required_argument, nullptr, 'f', },
-    { "help",    no_argument,       nullptr, 'h', },
-    { "version", no_argument,       nullptr, 'v', },
-    { nullptr,   no_argument,       nullptr, '\0' },
+    { "dir",          required_argument, nullptr, 'd', },
+    { "file",         required_argument, nullptr, 'f', },
+    { "help",         no_argument,       nullptr, 'h', },
+    { "version",      no_argument,       nullptr, 'v', },
+    { "trace",        required_argument, nullptr, opt_trace, },
+    { "trace-size",   required_argument, nullptr, opt_trace_size, },
+    { "decode-trace", required_argument, nullptr, opt_decode_trace, },
+    { "record",       required_argument, nullptr, opt_record, },
+    { "replay",       required_argument, nullptr, opt_replay, },
+    { "speed",        required_argument, nullptr, opt_speed, },
+    { "shards",       required_argument, nullptr, opt_shards, },
+    { "backend",      required_argument, nullptr, opt_backend, },
+    { "fork-server",  no_argument,       nullptr, opt_fork_server, },
+    { "worker",       no_argument,       nullptr, opt_worker, },
+    { "cache",        required_argument, nullptr, opt_cache, },
+    { "cache-size",   required_argument, nullptr, opt_cache_size, },
+    { "exclude",      required_argument, nullptr, opt_exclude, },
+    { "include",      required_argument, nullptr, opt_include, },
+    { "job",          required_argument, nullptr, opt_job, },
+    { "preempt",      no_argument,       nullptr, opt_preempt, },
+    { "git",          no_argument,       nullptr, opt_git, },
+    { "publish",      required_argument, nullptr, opt_publish, },
+    { "print-events", optional_argument, nullptr, opt_print_events, },
+    { "stage",        required_argument, nullptr, opt_stage, },
+    { "ninja",        required_argument, nullptr, opt_ninja, },
+    { "compdb",       required_argument, nullptr, opt_compdb, },
+    { "parallel",     required_argument, nullptr, opt_parallel, },
+    { "depfiles",     required_argument, nullptr, opt_depfiles, },
+    { "tests",        required_argument, nullptr, opt_tests, },
+    { "jobserver",    required_argument, nullptr, opt_jobserver, },
+    { "pressure",     required_argument, nullptr, opt_pressure, },
+    { "max-rate",     required_argument, nullptr, opt_max_rate, },
+    { "tail",         no_argument,       nullptr, opt_tail, },
+    { "match",        required_argument, nullptr, opt_match, },
+    { nullptr,        no_argument,       nullptr, '\0' },
 };
 
 struct cli_option {
     std::vector<std::string> filenames;
     std::vector<std::string> dirnames;
     std::string cmd;
+    std::string trace_file;
+    uint32_t trace_size = 0;
+    std::string record_file;
+    std::string replay_file;
+    double speed = 1.0;
+    unsigned shards = 1;
+    std::string backend = "inotify";
+    bool fork_server = false;
+    bool worker = false;
+    std::string cache_dir;
+    uint64_t cache_size = 256;
+    std::vector<std::string> excludes;
+    std::vector<std::string> includes;
+    std::vector<std::string> jobs;
+    bool preempt = false;
+    bool git = false;
+    std::string publish;
+    std::string print_events;
+    std::vector<std::string> stages;
+    std::string ninja;
+    std::string compdb;
+    unsigned parallel = 0;
+    std::vector<std::string> depfile_dirs;
+    std::string test_map;
+    unsigned jobserver = 0;
+    double pressure = 0;
+    std::vector<std::string> max_rates;
+    bool tail = false;
+    std::string match;
 };
 
-bool is_dir(const char *filename)
-{
-    struct stat st;
-
-    if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode))
-        return true;
-    else
-        return false;
-}
-
-bool is_reg(const char *filename)
-{
-    struct stat st;
-
-    if (stat(filename, &st) == 0 && S_ISREG(st.st_mode))
-        return true;
-    else
-        return false;
-}
-
 void add_dir(const char *dirname, std::vector<std::string>& dirnames)
 {
     if (is_dir(dirname)) {
@@ -247,6 +277,125 @@ cli_option parse_opt(int argc, char *argv[])
                 else
                     add_file(optarg, cli.filenames);
                 break;
+            case opt_trace:
+                cli.trace_file = optarg;
+                break;
+            case opt_trace_size:
+                cli.trace_size = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case opt_decode_trace:
+                exit(trace_decode(optarg));
+            case opt_record:
+                cli.record_file = optarg;
+                break;
+            case opt_replay:
+                cli.replay_file = optarg;
+                break;
+            case opt_speed:
+                /* "10x" and "10" both mean ten times faster, 0 means no delay */
+                cli.speed = std::strtod(optarg, nullptr);
+                if (cli.speed < 0) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_shards:
+                cli.shards = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+                if (cli.shards == 0) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_backend:
+                cli.backend = optarg;
+                if (cli.backend != "inotify" && cli.backend != "fanotify"
+                    && cli.backend != "poll") {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_fork_server:
+                cli.fork_server = true;
+                break;
+            case opt_worker:
+                cli.worker = true;
+                break;
+            case opt_cache:
+                cli.cache_dir = optarg;
+                break;
+            case opt_cache_size:
+                cli.cache_size = std::strtoull(optarg, nullptr, 10);
+                break;
+            case opt_exclude:
+                cli.excludes.push_back(optarg);
+                break;
+            case opt_include:
+                cli.includes.push_back(optarg);
+                break;
+            case opt_job:
+                cli.jobs.push_back(optarg);
+                break;
+            case opt_preempt:
+                cli.preempt = true;
+                break;
+            case opt_git:
+                cli.git = true;
+                break;
+            case opt_publish:
+                cli.publish = optarg;
+                break;
+            case opt_print_events:
+                cli.print_events = optarg ? optarg : "ndjson";
+                if (cli.print_events != "ndjson" && cli.print_events != "nul") {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_stage:
+                cli.stages.push_back(optarg);
+                break;
+            case opt_ninja:
+                cli.ninja = optarg;
+                break;
+            case opt_compdb:
+                cli.compdb = optarg;
+                break;
+            case opt_parallel:
+                cli.parallel = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+                if (cli.parallel == 0) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_depfiles:
+                cli.depfile_dirs.push_back(optarg);
+                break;
+            case opt_tests:
+                cli.test_map = optarg;
+                break;
+            case opt_jobserver:
+                cli.jobserver = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+                if (cli.jobserver == 0) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_pressure:
+                cli.pressure = std::strtod(optarg, nullptr);
+                if (cli.pressure <= 0 || cli.pressure > 100) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case opt_max_rate:
+                cli.max_rates.push_back(optarg);
+                break;
+            case opt_tail:
+                cli.tail = true;
+                break;
+            case opt_match:
+                cli.match = optarg;
+                break;
             case 'v':
                 version(argv[0]);
                 exit(0);
@@ -260,7 +409,8 @@ cli_option parse_opt(int argc, char *argv[])
         }
     }
 
-    if (cli.dirnames.size() == 0 && cli.filenames.size() == 0)
+    if (cli.dirnames.size() == 0 && cli.filenames.size() == 0 && cli.ninja.empty()
+        && cli.compdb.empty() && cli.depfile_dirs.empty())
         cli.dirnames.push_back(".");
 
     if (optind < argc) {
@@ -276,162 +426,381 @@ cli_option parse_opt(int argc, char *argv[])
     return cli;
 }
 
-const char *inotify_event2str(const inotify_event *event)
+constexpr uint64_t feed_capacity = 16 << 20;
+
+static fork_server cmd_server;
+static result_cache cmd_cache;
+static build_graph ninja_graph;
+static compile_db compile_commands;
+static depfile_graph make_deps;
+static depfile_graph test_map;
+static jobserver make_jobserver;
+
+template <typename Policy>
+bool setup(Policy&, const cli_option&)
 {
-    if (event->mask & IN_ACCESS)
-        return "IN_ACCESS";
-    else if (event->mask & IN_ATTRIB)
-        return "IN_ATTRIB";
-    else if (event->mask & IN_CLOSE_WRITE)
-        return "IN_CLOSE_WRITE";
-    else if (event->mask & IN_CLOSE_NOWRITE)
-        return "IN_CLOSE_NOWRITE";
-    else if (event->mask & IN_CREATE)
-        return "IN_CREATE";
-    else if (event->mask & IN_DELETE)
-        return "IN_DELETE";
-    else if (event->mask & IN_DELETE_SELF)
-        return "IN_DELETE_SELF";
-    else if (event->mask & IN_MODIFY)
-        return "IN_MODIFY";
-    else if (event->mask & IN_MOVE_SELF)
-        return "IN_MOVE_SELF";
-    else if (event->mask & IN_MOVED_FROM)
-        return "IN_MOVED_FROM";
-    else if (event->mask & IN_MOVED_TO)
-        return "IN_MOVED_TO";
-    else if (event->mask & IN_OPEN)
-        return "IN_OPEN";
-    else if (event->mask & IN_IGNORED)
-        return "IN_IGNORED";
-    else if (event->mask & IN_ONLYDIR)
-        return "IN_ONLYDIR";
-    else if (event->mask & IN_DONT_FOLLOW)
-        return "IN_DONT_FOLLOW";
-    else if (event->mask & IN_EXCL_UNLINK)
-        return "IN_EXCL_UNLINK";
-    else if (event->mask & IN_MASK_ADD)
-        return "IN_MASK_ADD";
-    else if (event->mask & IN_ONESHOT)
-        return "IN_ONESHOT";
-    else
-        return "Unknown";
+    return true;
 }
 
-bool on_event(inotify& in, cli_option& cli_opts, struct epoll_event *e)
+bool setup(sharded_backend& backend, const cli_option& cli_opts)
 {
-    char buf[10 * sizeof(struct inotify_event)];
-    struct inotify_event *event;
-
-    if (e->data.fd != in.fd())
-        return true;
-
-    int rc = read(e->data.fd, buf, sizeof(buf) - 1);
-    if constexpr (debug) {
-        std::clog
-            << "read: rc=" << rc
-            << ", sizeof(struct inotify_event)=" << sizeof(struct inotify_event)
-            << ", sizeof(buf)-1=" << sizeof(buf)-1 << '\n';
+    return backend.init(cli_opts.shards);
+}
+
+template <typename Backend>
+bool setup(pressure_backend<Backend>& backend, const cli_option& cli_opts)
+{
+    backend.set_limit(cli_opts.pressure);
+    return setup(backend.inner(), cli_opts);
+}
+
+template <typename Backend>
+bool setup(rate_backend<Backend>& backend, const cli_option& cli_opts)
+{
+    for (auto& spec: cli_opts.max_rates) {
+        if (!backend.limiter().add(spec)) {
+            std::cerr << "autorun: invalid rate: " << spec << '\n';
+            return false;
+        }
     }
-    if (rc == -1)
-        return false;
+    return setup(backend.inner(), cli_opts);
+}
+
+template <typename Backend>
+bool setup(recording_backend<Backend>& backend, const cli_option& cli_opts)
+{
+    return backend.open(cli_opts.record_file.c_str()) && setup(backend.inner(), cli_opts);
+}
+
+template <typename Backend>
+bool setup(git_backend<Backend>& backend, const cli_option& cli_opts)
+{
+    backend.set_enabled(cli_opts.git);
+    return setup(backend.inner(), cli_opts);
+}
 
-    event = reinterpret_cast<struct inotify_event *>(buf);
+template <typename Backend>
+bool setup(input_backend<Backend>& backend, const cli_option& cli_opts)
+{
+    input_graph *graph = nullptr;
+
+    if (!cli_opts.ninja.empty())
+        graph = &ninja_graph;
+    else if (!cli_opts.compdb.empty())
+        graph = &compile_commands;
+    else if (!cli_opts.depfile_dirs.empty())
+        graph = &make_deps;
+
+    if (graph) {
+        /* the shards are already read when the graph brings new directories */
+        if (cli_opts.shards > 1) {
+            std::cerr << "autorun: --shards cannot be used with --ninja, --compdb "
+                "or --depfiles\n";
+            return false;
+        }
+        backend.set_graph(graph);
+    }
+    return setup(backend.inner(), cli_opts);
+}
 
-    if (event->mask & IN_IGNORED)
-        in.add_watch(in.get_file(event->wd));
+bool setup(goal_scheduler<build_graph>& scheduler, const cli_option& cli_opts)
+{
+    scheduler.set_graph(&ninja_graph);
+    scheduler.set_command(cli_opts.cmd);
+    return true;
+}
 
-    if (event->mask & (IN_CREATE | IN_ISDIR))
-        in.add_watch(in.get_file(event->wd) + '/' + event->name);
+bool setup(goal_scheduler<depfile_graph>& scheduler, const cli_option& cli_opts)
+{
+    scheduler.set_graph(&make_deps);
+    scheduler.set_command(cli_opts.cmd);
+    return true;
+}
 
-    if constexpr (debug) {
-        std::clog << "Event: " << inotify_event2str(event) << '\n';
-        std::clog << "Name: " << in.get_file(event->wd);
-        if (event->mask & IN_ISDIR)
-            std::clog << '/' << event->name;
-        std::clog << '\n';
+bool setup(compile_scheduler& scheduler, const cli_option& cli_opts)
+{
+    scheduler.set_db(&compile_commands);
+    if (cli_opts.parallel)
+        scheduler.pool().set_size(cli_opts.parallel);
+    else if (cli_opts.jobserver)
+        scheduler.pool().set_size(cli_opts.jobserver);
+    if (cli_opts.jobserver)
+        scheduler.pool().set_jobserver(&make_jobserver);
+    return scheduler.start();
+}
+
+bool add_rules(path_set& set, const std::vector<std::string>& rules)
+{
+    for (auto& rule: rules) {
+        if (!set.add(rule)) {
+            std::cerr << "autorun: invalid rule: " << rule << '\n';
+            return false;
+        }
     }
 
-    /* XXX what to do with rc ? */
-    rc = run_cmd(cli_opts.cmd.c_str());
     return true;
 }
 
-int watch_dir(const cli_option& cli_opts, inotify& in)
+bool setup(rule_filter& filter, const cli_option& cli_opts)
 {
-    std::vector<char *> rootname;
-    FTS *root;
-
-    rootname.resize(cli_opts.dirnames.size() + 1);
-    auto iter = rootname.begin();
-    for (auto dir: cli_opts.dirnames)
-        *iter++ = strdup(dir.c_str());
-    *iter = nullptr;
-
-    root = fts_open(&rootname[0], FTS_PHYSICAL | FTS_NOSTAT | FTS_NOCHDIR, nullptr);
-    if (!root) {
-        error(errno, "fts_open");
-        return -1;
+    return add_rules(filter.exclude(), cli_opts.excludes)
+        && add_rules(filter.include(), cli_opts.includes);
+}
+
+bool setup(command_scheduler& scheduler, const cli_option& cli_opts)
+{
+    scheduler.set_command(cli_opts.cmd);
+    if (cli_opts.fork_server)
+        scheduler.set_fork_server(&cmd_server);
+
+    if (!cli_opts.test_map.empty()) {
+        std::string map = absolute_path(cli_opts.test_map);
+
+        test_map.update(map);
+        if (test_map.size() == 0) {
+            std::cerr << "autorun: " << cli_opts.test_map << ": no test found\n";
+            return false;
+        }
+        scheduler.set_tests(&test_map, std::move(map));
     }
 
-    traverse(root, in);
-    fts_close(root);
+    if (!cli_opts.cache_dir.empty()) {
+        if (!cmd_cache.open(cli_opts.cache_dir, cli_opts.cache_size << 20))
+            return false;
+        cmd_cache.set_inputs(cli_opts.dirnames, cli_opts.filenames);
+        scheduler.set_cache(&cmd_cache);
+    }
 
-    for (auto dir: rootname)
-        free(dir);
+    clear_screen();
+    return true;
+}
 
-    return 0;
+bool setup(worker_scheduler& scheduler, const cli_option& cli_opts)
+{
+    scheduler.set_command(cli_opts.cmd);
+    return scheduler.start();
+}
+
+bool setup(tail_scheduler& scheduler, const cli_option& cli_opts)
+{
+    scheduler.set_command(cli_opts.cmd);
+    if (!cli_opts.match.empty() && !scheduler.set_match(cli_opts.match))
+        return false;
+    scheduler.set_inputs(cli_opts.dirnames, cli_opts.filenames);
+    return scheduler.start();
+}
+
+bool setup(print_scheduler& scheduler, const cli_option& cli_opts)
+{
+    if (cli_opts.print_events == "nul")
+        scheduler.set_format(print_scheduler::format::nul);
+    return scheduler.start();
+}
+
+bool setup(feed_scheduler& scheduler, const cli_option& cli_opts)
+{
+    return scheduler.open(cli_opts.publish, feed_capacity);
 }
 
-bool watch_file(const cli_option& cli_opts, inotify& in)
+/* <priority>:<rules>:<cmd> */
+bool add_job(job_scheduler& scheduler, const std::string& spec)
 {
-    for (auto f: cli_opts.filenames) {
-        bool rc = in.add_watch(f.c_str());
-        if (!rc)
+    size_t rules = spec.find(':');
+    size_t cmd = rules == std::string::npos ? rules : spec.find(':', rules + 1);
+    char *end;
+
+    if (rules == 0 || cmd == std::string::npos || cmd + 1 == spec.size())
+        return false;
+
+    long priority = std::strtol(spec.c_str(), &end, 10);
+    if (end != spec.c_str() + rules)
+        return false;
+
+    return scheduler.add_job(static_cast<int>(priority), spec.substr(rules + 1, cmd - rules - 1),
+                             spec.substr(cmd + 1));
+}
+
+bool setup(job_scheduler& scheduler, const cli_option& cli_opts)
+{
+    for (auto& spec: cli_opts.jobs) {
+        if (!add_job(scheduler, spec)) {
+            std::cerr << "autorun: invalid job: " << spec << '\n';
             return false;
+        }
     }
-    return true;
+
+    /* <cmd> runs for every change, ahead of the jobs */
+    if (!cli_opts.cmd.empty())
+        scheduler.add_job(0, "", cli_opts.cmd);
+
+    scheduler.set_preempt(cli_opts.preempt);
+    scheduler.set_pressure(cli_opts.pressure);
+    if (cli_opts.jobserver)
+        scheduler.set_jobserver(&make_jobserver);
+    return scheduler.start();
 }
 
-void clear_screen()
+/* <name>:<rules>:<cmd> */
+bool add_stage(pipeline_scheduler& scheduler, const std::string& spec)
 {
-    std::cout << "\033[2J\033[1;1H";
-    std::cout.flush();
+    size_t rules = spec.find(':');
+    size_t cmd = rules == std::string::npos ? rules : spec.find(':', rules + 1);
+
+    if (rules == 0 || cmd == std::string::npos || cmd + 1 == spec.size())
+        return false;
+
+    return scheduler.add_stage(spec.substr(0, rules), spec.substr(rules + 1, cmd - rules - 1),
+                               spec.substr(cmd + 1));
 }
 
-int main(int argc, char *argv[])
+bool setup(pipeline_scheduler& scheduler, const cli_option& cli_opts)
 {
-    auto cli_opts = parse_opt(argc, argv);
-    inotify in;
-    epoll ep;
-    int rc = 0;
-
-    if (!cli_opts.dirnames.empty()) {
-        rc = watch_dir(cli_opts, in);
-        if (rc) {
-            error(errno, "watch_dir");
-            return errno;
+    for (auto& spec: cli_opts.stages) {
+        if (!add_stage(scheduler, spec)) {
+            std::cerr << "autorun: invalid stage: " << spec << '\n';
+            return false;
         }
+    }
+
+    /* <cmd> is the last stage, run for every change */
+    if (!cli_opts.cmd.empty())
+        scheduler.add_stage("cmd", "", cli_opts.cmd);
+
+    return scheduler.start();
+}
 
+template <typename Watcher, typename Backend>
+int run(Watcher& w, Backend& backend, const cli_option& cli_opts)
+{
+    if (!setup(backend, cli_opts) || !setup(w.filter(), cli_opts)
+        || !setup(w.scheduler(), cli_opts))
+        return 1;
+
+    /* the jobs hold their background ones only */
+    if constexpr (std::is_same_v<std::decay_t<decltype(w.scheduler())>, job_scheduler>)
+        backend.set_limit(0);
+
+    /* the entries stored would trigger the next run */
+    if constexpr (has_skip<Backend>::value) {
+        if (cmd_cache.is_open())
+            backend.set_skip({cmd_cache.dir()});
     }
 
-    if (!cli_opts.filenames.empty()) {
-        rc = watch_file(cli_opts, in);
-        if (!rc) {
-            error(errno, "watch_file");
-            return errno;
-        }
+    if (!cli_opts.dirnames.empty() && !w.watch_dir(cli_opts.dirnames)) {
+        error(errno, "watch_dir");
+        return errno;
     }
-    ep.add(in.fd());
 
-    if constexpr (!debug)
-        clear_screen();
+    if (!cli_opts.filenames.empty() && !w.watch_file(cli_opts.filenames)) {
+        error(errno, "watch_file");
+        return errno;
+    }
 
-    ep.wait([&in, &cli_opts](struct epoll_event *e) -> bool {
-        if constexpr (!debug)
-            clear_screen();
-        return on_event(in, cli_opts, e);
-    });
+    w.run();
+    return 0;
+}
+
+/* The changes of Backend, held while git works, the machine is busy or too many ran */
+template <typename Backend>
+using limited_backend = pressure_backend<rate_backend<git_backend<input_backend<Backend>>>>;
 
+template <typename Backend, typename Scheduler>
+int watch(const cli_option& cli_opts)
+{
+    /* the changes as they come, before the gates */
+    if (!cli_opts.record_file.empty()) {
+        watcher<limited_backend<recording_backend<Backend>>, rule_filter, Scheduler> w;
+        return run(w, w.backend(), cli_opts);
+    }
+
+    watcher<limited_backend<Backend>, rule_filter, Scheduler> w;
+    return run(w, w.backend(), cli_opts);
+}
+
+template <typename Scheduler>
+int replay(const cli_option& cli_opts)
+{
+    watcher<git_backend<replay_backend>, rule_filter, Scheduler> w;
+    replay_backend& backend = w.backend().inner();
+    /* nor are the background jobs held by the load at the time */
+    cli_option replay_opts = cli_opts;
+    replay_opts.pressure = 0;
+
+    if (!backend.open(cli_opts.replay_file.c_str(), cli_opts.speed)
+        || !setup(w.backend(), cli_opts) || !setup(w.filter(), cli_opts)
+        || !setup(w.scheduler(), replay_opts))
+        return 1;
+
+    uint64_t start = now_ns();
+    w.run();
+    uint64_t elapsed = now_ns() - start;
+
+    if (backend.reader().corrupted()) {
+        std::cerr << "autorun: " << cli_opts.replay_file << ": corrupted recording\n";
+        return 1;
+    }
+
+    std::clog << "autorun: replayed " << backend.nevents() << " events in "
+        << backend.nbatches() << " batches in " << elapsed / 1000000 << " ms\n";
     return 0;
 }
+
+template <typename Scheduler>
+int select_backend(const cli_option& cli_opts)
+{
+    if (!cli_opts.replay_file.empty())
+        return replay<Scheduler>(cli_opts);
+
+    if (cli_opts.backend == "fanotify")
+        return watch<fanotify_backend, Scheduler>(cli_opts);
+    if (cli_opts.backend == "poll")
+        return watch<poll_backend, Scheduler>(cli_opts);
+    if (cli_opts.shards > 1)
+        return watch<sharded_backend, Scheduler>(cli_opts);
+
+    return watch<inotify_backend, Scheduler>(cli_opts);
+}
+
+int main(int argc, char *argv[])
+{
+    auto cli_opts = parse_opt(argc, argv);
+
+    if (!cli_opts.trace_file.empty()
+        && !trace_start(cli_opts.trace_file.c_str(), cli_opts.trace_size))
+        return 1;
+
+    /* in MAKEFLAGS before anything is spawned, the fork server included */
+    if (cli_opts.jobserver && !make_jobserver.start(cli_opts.jobserver))
+        return 1;
+
+    /* from a small image, before the watch tables grow */
+    if (cli_opts.fork_server && !cmd_server.start())
+        return 1;
+
+    if (!cli_opts.ninja.empty() && !ninja_graph.load(cli_opts.ninja))
+        return 1;
+    if (!cli_opts.compdb.empty() && !compile_commands.load(cli_opts.compdb))
+        return 1;
+    if (!cli_opts.depfile_dirs.empty() && !make_deps.load(cli_opts.depfile_dirs))
+        return 1;
+
+    if (!cli_opts.print_events.empty())
+        return select_backend<print_scheduler>(cli_opts);
+    if (!cli_opts.publish.empty())
+        return select_backend<feed_scheduler>(cli_opts);
+    if (cli_opts.worker)
+        return select_backend<worker_scheduler>(cli_opts);
+    if (cli_opts.tail || !cli_opts.match.empty())
+        return select_backend<tail_scheduler>(cli_opts);
+    if (!cli_opts.ninja.empty())
+        return select_backend<goal_scheduler<build_graph>>(cli_opts);
+    if (!cli_opts.compdb.empty())
+        return select_backend<compile_scheduler>(cli_opts);
+    if (!cli_opts.depfile_dirs.empty())
+        return select_backend<goal_scheduler<depfile_graph>>(cli_opts);
+    if (!cli_opts.stages.empty())
+        return select_backend<pipeline_scheduler>(cli_opts);
+    if (!cli_opts.jobs.empty())
+        return select_backend<job_scheduler>(cli_opts);
+    return select_backend<command_scheduler>(cli_opts);
+}
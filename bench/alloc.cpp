@@ -0,0 +1,141 @@
+/*
+ * Heap allocations made by the watcher per change, once warmed up: from the
+ * inotify read to the scheduler, through the filter and coalescing. Exits
+ * with an error when there are more than the allowed number per change
+ * handed to the scheduler.
+ *
+ *   alloc-bench [rounds] [max allocations per change]
+ */
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "watcher.h"
+
+static size_t allocations = 0;
+static bool counting = false;
+
+void *operator new(size_t size)
+{
+    if (counting)
+        allocations++;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+struct count_changes {
+    size_t *changes;
+
+    bool operator()(change_batch& batch)
+    {
+        *changes += batch.size();
+        return true;
+    }
+};
+
+static bool pending(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+    double max_per_change = argc > 2 ? std::strtod(argv[2], nullptr) : 0;
+    char root[] = "/tmp/autorun-alloc-XXXXXX";
+    std::vector<std::string> dirs, files;
+    size_t changes = 0, writes = 0;
+
+    if (!mkdtemp(root))
+        return 1;
+
+    /* long enough names for the paths not to fit in std::string's buffer */
+    std::string dir = root;
+    for (const char *name: {"/first-level-directory", "/second-level-directory"}) {
+        dir += name;
+        dirs.push_back(dir);
+        mkdir(dir.c_str(), 0755);
+    }
+    for (int i = 0; i < 64; ++i) {
+        files.push_back(dir + "/source-file-" + std::to_string(i) + (i % 4 ? ".cpp" : ".o"));
+        close(open(files.back().c_str(), O_WRONLY | O_CREAT, 0644));
+    }
+
+    watcher<inotify_backend, rule_filter, count_changes> w{count_changes{&changes}};
+    w.filter().exclude().add("*.o");
+    w.filter().exclude().add("build/");
+
+    if (!w.watch_dir({root}) || !w.start())
+        return 1;
+
+    /* the first rounds size the buffers */
+    for (unsigned r = 0; r < rounds + 3; ++r) {
+        for (auto& f: files) {
+            int fd = open(f.c_str(), O_WRONLY);
+            if (write(fd, "x", 1) != 1)
+                return 1;
+            close(fd);
+            writes++;
+        }
+
+        counting = r >= 3;
+        while (pending(w.fd()))
+            w.on_readable();
+        counting = false;
+
+        if (r < 3)
+            writes = changes = 0;
+    }
+
+    for (auto& f: files)
+        unlink(f.c_str());
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it)
+        rmdir(it->c_str());
+    rmdir(root);
+
+    double per_change = changes ? static_cast<double>(allocations) / changes : 0;
+    std::printf("%zu writes, %zu changes, %zu allocations, %.3f per change\n",
+                writes, changes, allocations, per_change);
+
+    if (per_change > max_per_change) {
+        std::fprintf(stderr, "alloc-bench: more than %.3f allocations per change\n",
+                     max_per_change);
+        return 1;
+    }
+
+    return 0;
+}
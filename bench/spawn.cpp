@@ -0,0 +1,58 @@
+/*
+ * Spawn latency of a trivial command through system(), posix_spawn and the
+ * fork server, first from a small process, then once the process holds a
+ * large, touched heap (standing for big watch tables).
+ *
+ *   spawn-bench [runs] [heap MiB]
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "spawner.h"
+#include "util.h"
+
+template <typename F>
+static void measure(const char *name, size_t heap_mib, unsigned runs, F spawn)
+{
+    std::vector<uint64_t> samples;
+
+    for (unsigned i = 0; i < runs; ++i) {
+        uint64_t start = now_ns();
+        spawn();
+        samples.push_back(now_ns() - start);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::printf("%-12s %6zu MiB  p50 %8.1f us  p99 %8.1f us\n", name, heap_mib,
+                samples[runs / 2] / 1000.0, samples[runs * 99 / 100] / 1000.0);
+}
+
+static void measure_all(fork_server& server, size_t heap_mib, unsigned runs)
+{
+    measure("system", heap_mib, runs, [] { return system("true"); });
+    measure("posix_spawn", heap_mib, runs, [] { return spawn_cmd("true"); });
+    measure("fork-server", heap_mib, runs, [&server] { return server.run("true"); });
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned runs = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+    size_t heap_mib = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+    fork_server server;
+
+    if (runs == 0 || !server.start())
+        return 1;
+
+    measure_all(server, 0, runs);
+
+    /* touch every page so that it has to be mapped in the child */
+    std::vector<char> heap(heap_mib << 20);
+    for (size_t i = 0; i < heap.size(); i += 4096)
+        heap[i] = 1;
+
+    measure_all(server, heap_mib, runs);
+    return heap[0] == 1 ? 0 : 1;
+}
@@ -0,0 +1,497 @@
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/timerfd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "backend.h"
+
+bool sharded_backend::init(unsigned nshards)
+{
+    _notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_notify_fd == -1) {
+        error(errno, "eventfd");
+        return false;
+    }
+
+    for (unsigned i = 0; i < nshards; ++i)
+        _shards.push_back(std::make_unique<shard>(_notify_fd));
+
+    return true;
+}
+
+bool sharded_backend::watch_dir(const std::vector<std::string>& dirnames)
+{
+    std::vector<std::vector<std::string>> subtrees(_shards.size());
+    size_t next = 0;
+
+    for (auto& dir: dirnames) {
+        if (dirnames.size() >= _shards.size()) {
+            subtrees[next++ % _shards.size()].push_back(dir);
+            continue;
+        }
+
+        if (!_shards[next % _shards.size()]->watches().add_watch(dir))
+            return false;
+
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+            return false;
+
+        while (auto entry = readdir(d)) {
+            std::string path = dir + '/' + entry->d_name;
+
+            if (!std::strcmp(entry->d_name, ".") || !std::strcmp(entry->d_name, ".."))
+                continue;
+            if (entry->d_type == DT_DIR
+                || (entry->d_type == DT_UNKNOWN && is_dir(path.c_str())))
+                subtrees[next++ % _shards.size()].push_back(std::move(path));
+        }
+        closedir(d);
+    }
+
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        if (::watch_dir(subtrees[i], _shards[i]->watches()))
+            return false;
+    }
+
+    return true;
+}
+
+bool sharded_backend::watch_children(const std::vector<std::string>& dirnames)
+{
+    return ::watch_children(dirnames, _shards[0]->watches());
+}
+
+bool sharded_backend::watch_file(const std::vector<std::string>& filenames)
+{
+    return ::watch_file(filenames, _shards[0]->watches());
+}
+
+bool sharded_backend::start()
+{
+    for (auto& s: _shards)
+        s->start();
+    return _notify_fd != -1;
+}
+
+bool sharded_backend::read(change_batch& batch)
+{
+    uint64_t count;
+    size_t first = batch.size();
+
+    if (::read(_notify_fd, &count, sizeof(count)) == -1)
+        return errno == EINTR || errno == EAGAIN;
+
+    for (auto& s: _shards)
+        s->take(batch);
+
+    std::stable_sort(batch.begin() + first, batch.end(),
+                     [](const change& a, const change& b) { return a.ts < b.ts; });
+    return true;
+}
+
+sharded_backend::~sharded_backend()
+{
+    _shards.clear();
+    if (_notify_fd != -1)
+        close(_notify_fd);
+}
+
+constexpr uint64_t fanotify_mask = FAN_CREATE | FAN_DELETE | FAN_MODIFY
+    | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR;
+
+fanotify_backend::fanotify_backend()
+    : _fd{-1}, _init_errno{0}, _roots{}, _mounts{}
+{
+    _fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_DFID_NAME,
+                        O_RDONLY | O_CLOEXEC);
+    if (_fd == -1)
+        _init_errno = errno;
+}
+
+bool fanotify_backend::mark(const std::string& path, scope covered)
+{
+    char real[PATH_MAX];
+    struct statfs st;
+
+    if (_fd == -1) {
+        errno = _init_errno;
+        return false;
+    }
+
+    if (!realpath(path.c_str(), real))
+        return false;
+
+    int mount_fd = open(real, O_RDONLY | O_CLOEXEC);
+    if (mount_fd == -1 || fstatfs(mount_fd, &st) == -1) {
+        if (mount_fd != -1)
+            close(mount_fd);
+        return false;
+    }
+
+    uint64_t fsid;
+    static_assert(sizeof(fsid) == sizeof(st.f_fsid), "unexpected fsid size");
+    std::memcpy(&fsid, &st.f_fsid, sizeof(fsid));
+
+    /* one mark covers the whole filesystem, watched() narrows it down */
+    if (!_mounts.emplace(fsid, mount_fd).second) {
+        close(mount_fd);
+    } else if (fanotify_mark(_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                             fanotify_mask, AT_FDCWD, real) == -1) {
+        return false;
+    }
+
+    trace(trace_kind::watch, _fd, fanotify_mask, real, std::strlen(real));
+    _roots.emplace_back(real, covered);
+    return true;
+}
+
+bool fanotify_backend::watch_dir(const std::vector<std::string>& dirnames)
+{
+    for (auto& dir: dirnames) {
+        if (!mark(dir, tree))
+            return false;
+    }
+    return true;
+}
+
+bool fanotify_backend::watch_children(const std::vector<std::string>& dirnames)
+{
+    for (auto& dir: dirnames) {
+        if (!mark(dir, children))
+            return false;
+    }
+    return true;
+}
+
+bool fanotify_backend::watch_file(const std::vector<std::string>& filenames)
+{
+    for (auto& file: filenames) {
+        if (!mark(file, self))
+            return false;
+    }
+    return true;
+}
+
+bool fanotify_backend::watched(const std::string& path) const
+{
+    for (auto& root: _roots) {
+        auto& name = root.first;
+
+        if (path == name)
+            return true;
+        if (root.second == self || path.compare(0, name.size(), name) != 0)
+            continue;
+
+        size_t base = name.back() == '/' ? name.size() : name.size() + 1;
+        if (base > name.size() && path[name.size()] != '/')
+            continue;
+        if (root.second == tree || path.find('/', base) == std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+bool fanotify_backend::resolve(const void *info, std::string& path)
+{
+    auto fid = static_cast<const struct fanotify_event_info_fid *>(info);
+    auto handle = reinterpret_cast<struct file_handle *>(
+        const_cast<unsigned char *>(fid->handle));
+    auto name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+    char proc[32], buf[PATH_MAX];
+    uint64_t fsid;
+
+    std::memcpy(&fsid, &fid->fsid, sizeof(fsid));
+    auto mount = _mounts.find(fsid);
+    if (mount == _mounts.end())
+        return false;
+
+    /* fails when the directory is already gone */
+    int dfd = open_by_handle_at(mount->second, handle, O_PATH | O_CLOEXEC);
+    if (dfd == -1)
+        return false;
+
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", dfd);
+    ssize_t len = readlink(proc, buf, sizeof(buf));
+    close(dfd);
+    if (len <= 0)
+        return false;
+
+    path.assign(buf, len);
+    if (std::strcmp(name, ".")) {
+        if (path.back() != '/')
+            path.push_back('/');
+        path.append(name);
+    }
+    return true;
+}
+
+bool fanotify_backend::read(change_batch& batch)
+{
+    alignas(struct fanotify_event_metadata) char buf[8192];
+    std::string path;
+
+    ssize_t len = ::read(_fd, buf, sizeof(buf));
+    trace(trace_kind::read, _fd, len);
+    if (len == -1)
+        return errno == EINTR || errno == EAGAIN;
+
+    uint64_t ts = now_ns();
+    auto meta = reinterpret_cast<struct fanotify_event_metadata *>(buf);
+
+    for (; FAN_EVENT_OK(meta, len); meta = FAN_EVENT_NEXT(meta, len)) {
+        if (meta->vers != FANOTIFY_METADATA_VERSION) {
+            std::fprintf(stderr, "autorun: unsupported fanotify version\n");
+            return false;
+        }
+
+        /* the FAN_* bits used here have the values of their IN_* twins */
+        auto mask = static_cast<uint32_t>(meta->mask);
+
+        if (mask & FAN_Q_OVERFLOW) {
+            batch.push_back({ts, IN_Q_OVERFLOW, {}});
+            continue;
+        }
+
+        auto info = reinterpret_cast<const struct fanotify_event_info_header *>(meta + 1);
+        if (meta->event_len <= sizeof(*meta)
+            || info->info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+            continue;
+
+        if (!resolve(info, path) || !watched(path))
+            continue;
+
+        trace(trace_kind::event, _fd, mask, path);
+        batch.push_back({ts, mask, path});
+    }
+
+    return true;
+}
+
+fanotify_backend::~fanotify_backend()
+{
+    for (auto& mount: _mounts)
+        close(mount.second);
+    if (_fd != -1)
+        close(_fd);
+}
+
+poll_backend::poll_backend()
+    : _timer_fd{timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)},
+      _interval_ms{1000}, _dirs{}, _shallow{}, _files{}, _snapshot{}
+{
+}
+
+void poll_backend::add(snapshot& snap, const std::string& path, const struct stat& st)
+{
+    snap[path] = {
+        st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec,
+        st.st_size,
+        st.st_ino,
+        S_ISDIR(st.st_mode),
+    };
+}
+
+void poll_backend::scan(snapshot& snap) const
+{
+    scan(_dirs, false, snap);
+    scan(_shallow, true, snap);
+
+    for (auto& file: _files) {
+        struct stat st;
+
+        if (stat(file.c_str(), &st) == 0)
+            add(snap, file, st);
+    }
+}
+
+/* Add dirnames and what they hold to snap, their entries only when shallow. */
+void poll_backend::scan(const std::vector<std::string>& dirnames, bool shallow,
+                        snapshot& snap) const
+{
+    std::vector<char *> rootname;
+
+    if (dirnames.empty())
+        return;
+
+    for (auto& dir: dirnames)
+        rootname.push_back(const_cast<char *>(dir.c_str()));
+    rootname.push_back(nullptr);
+
+    FTS *root = fts_open(rootname.data(), FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+    if (!root) {
+        error(errno, "fts_open");
+        return;
+    }
+
+    while (FTSENT *file = fts_read(root)) {
+        if (file->fts_info == FTS_DP || file->fts_info == FTS_NS
+            || file->fts_info == FTS_DNR || file->fts_info == FTS_ERR)
+            continue;
+        if (shallow && file->fts_level > 0 && file->fts_info == FTS_D)
+            fts_set(root, file, FTS_SKIP);
+        add(snap, file->fts_path, *file->fts_statp);
+    }
+    fts_close(root);
+}
+
+bool poll_backend::watch_dir(const std::vector<std::string>& dirnames)
+{
+    _dirs.insert(_dirs.end(), dirnames.begin(), dirnames.end());
+    _snapshot.clear();
+    scan(_snapshot);
+    return true;
+}
+
+bool poll_backend::watch_children(const std::vector<std::string>& dirnames)
+{
+    _shallow.insert(_shallow.end(), dirnames.begin(), dirnames.end());
+    _snapshot.clear();
+    scan(_snapshot);
+    return true;
+}
+
+bool poll_backend::watch_file(const std::vector<std::string>& filenames)
+{
+    _files.insert(_files.end(), filenames.begin(), filenames.end());
+    _snapshot.clear();
+    scan(_snapshot);
+    return true;
+}
+
+bool poll_backend::start()
+{
+    struct itimerspec its;
+
+    its.it_interval.tv_sec = _interval_ms / 1000;
+    its.it_interval.tv_nsec = (_interval_ms % 1000) * 1000000l;
+    its.it_value = its.it_interval;
+
+    if (_timer_fd == -1 || timerfd_settime(_timer_fd, 0, &its, nullptr) == -1) {
+        error(errno, "timerfd");
+        return false;
+    }
+    return true;
+}
+
+bool poll_backend::read(change_batch& batch)
+{
+    uint64_t expirations;
+    snapshot snap;
+
+    if (::read(_timer_fd, &expirations, sizeof(expirations)) == -1)
+        return errno == EINTR || errno == EAGAIN;
+
+    uint64_t ts = now_ns();
+    scan(snap);
+
+    for (auto& file: snap) {
+        auto old = _snapshot.find(file.first);
+        uint32_t isdir = file.second.dir ? IN_ISDIR : 0;
+
+        if (old == _snapshot.end()) {
+            batch.push_back({ts, IN_CREATE | isdir, file.first});
+        } else if (!file.second.dir
+                   && (old->second.mtime != file.second.mtime
+                       || old->second.size != file.second.size
+                       || old->second.ino != file.second.ino)) {
+            batch.push_back({ts, IN_MODIFY, file.first});
+        }
+    }
+
+    for (auto& file: _snapshot) {
+        if (snap.find(file.first) == snap.end())
+            batch.push_back({ts, IN_DELETE | (file.second.dir ? IN_ISDIR : 0u), file.first});
+    }
+
+    _snapshot = std::move(snap);
+    return true;
+}
+
+poll_backend::~poll_backend()
+{
+    if (_timer_fd != -1)
+        close(_timer_fd);
+}
+
+replay_backend::replay_backend()
+    : _reader{}, _timer_fd{timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)},
+      _speed{1}, _next{}, _exhausted{false}, _nevents{0}, _nbatches{0}
+{
+}
+
+bool replay_backend::open(const char *filename, double speed)
+{
+    _speed = speed;
+    if (!_reader.open(filename))
+        return false;
+
+    if (!_reader.next(_next)) {
+        _next.clear();
+        _exhausted = true;
+    }
+    return true;
+}
+
+/* timerfd_settime() disarms the timer on a zero delay, hence the 1ns minimum */
+bool replay_backend::arm(uint64_t delay)
+{
+    struct itimerspec its = {};
+
+    if (delay == 0)
+        delay = 1;
+    its.it_value.tv_sec = delay / 1000000000;
+    its.it_value.tv_nsec = delay % 1000000000;
+
+    if (_timer_fd == -1 || timerfd_settime(_timer_fd, 0, &its, nullptr) == -1) {
+        error(errno, "timerfd");
+        return false;
+    }
+    return true;
+}
+
+bool replay_backend::read(change_batch& batch)
+{
+    uint64_t expirations;
+
+    if (::read(_timer_fd, &expirations, sizeof(expirations)) == -1)
+        return errno == EINTR || errno == EAGAIN;
+
+    if (_exhausted)
+        return false;
+
+    uint64_t ts = _reader.ts();
+
+    _nevents += _next.size();
+    _nbatches++;
+    batch.append(_next);
+
+    if (_reader.next(_next)) {
+        uint64_t delay = 0;
+
+        if (_speed > 0 && _reader.ts() > ts)
+            delay = (_reader.ts() - ts) / _speed;
+        return arm(delay);
+    }
+
+    _next.clear();
+    _exhausted = true;
+    return arm(0);
+}
+
+replay_backend::~replay_backend()
+{
+    if (_timer_fd != -1)
+        close(_timer_fd);
+}
@@ -0,0 +1,381 @@
+#ifndef AUTORUN_BACKEND_H
+#define AUTORUN_BACKEND_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "change.h"
+#include "inotify.h"
+#include "record.h"
+#include "shard.h"
+
+/*
+ * Backends are where the changes come from. A watcher only relies on:
+ *
+ *   bool watch_dir(const std::vector<std::string>& dirnames);
+ *   bool watch_file(const std::vector<std::string>& filenames);
+ *   bool start();                    called once the watches are set up
+ *   int fd();                        readable when read() has work to do
+ *   bool read(change_batch& batch);  append the pending changes, false to stop
+ *
+ * The inotify based ones can also leave the content of some directories out,
+ * or these directories altogether:
+ *
+ *   void set_prune(names);           see inotify::set_prune()
+ *   void set_skip(dirnames);         see inotify::set_skip()
+ *
+ * which the wrappers around them forward when has_prune and has_skip tell
+ * they are there. For input_backend and git_backend, every backend also
+ * watches a directory and its entries, without going down its
+ * subdirectories:
+ *
+ *   bool watch_children(const std::vector<std::string>& dirnames);
+ */
+
+template <typename Backend, typename = void>
+struct has_prune : std::false_type {
+};
+
+template <typename Backend>
+struct has_prune<Backend, std::void_t<decltype(std::declval<Backend&>().set_prune({}))>>
+    : std::true_type {
+};
+
+template <typename Backend, typename = void>
+struct has_skip : std::false_type {
+};
+
+template <typename Backend>
+struct has_skip<Backend, std::void_t<decltype(std::declval<Backend&>().set_skip({}))>>
+    : std::true_type {
+};
+
+class inotify_backend {
+    public:
+        void set_prune(std::vector<std::string> names)
+        {
+            _in.set_prune(std::move(names));
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            _in.set_skip(dirnames);
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return ::watch_dir(dirnames, _in) == 0;
+        }
+
+        bool watch_children(const std::vector<std::string>& dirnames)
+        {
+            return ::watch_children(dirnames, _in);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return ::watch_file(filenames, _in);
+        }
+
+        bool start()
+        {
+            return true;
+        }
+
+        int fd()
+        {
+            return _in.fd();
+        }
+
+        bool read(change_batch& batch)
+        {
+            return read_changes(_in, batch);
+        }
+
+    private:
+        inotify _in;
+};
+
+/*
+ * Several inotify instances, each drained by its own thread, see shard.
+ * Their queues are merged into a single stream ordered by read time.
+ */
+class sharded_backend {
+    public:
+        sharded_backend() : _shards{}, _notify_fd{-1}
+        {
+        }
+
+        bool init(unsigned nshards);
+
+        void set_prune(const std::vector<std::string>& names)
+        {
+            for (auto& s: _shards)
+                s->watches().set_prune(names);
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            for (auto& s: _shards)
+                s->watches().set_skip(dirnames);
+        }
+
+        /*
+         * Spread dirnames over the shards. When there are fewer roots than
+         * shards, each root is watched on its own and its subdirectories
+         * are distributed instead. Directories created later stay in the
+         * shard of their parent.
+         */
+        bool watch_dir(const std::vector<std::string>& dirnames);
+        bool watch_children(const std::vector<std::string>& dirnames);
+        bool watch_file(const std::vector<std::string>& filenames);
+        bool start();
+
+        int fd()
+        {
+            return _notify_fd;
+        }
+
+        bool read(change_batch& batch);
+
+        ~sharded_backend();
+
+    private:
+        std::vector<std::unique_ptr<shard>> _shards;
+        int _notify_fd;
+};
+
+/*
+ * fanotify with directory file handles (Linux 5.9, CAP_SYS_ADMIN): one mark
+ * per filesystem instead of one watch per directory. Events outside of the
+ * watched trees are dropped, paths are reported canonicalized.
+ */
+class fanotify_backend {
+    public:
+        fanotify_backend();
+
+        bool watch_dir(const std::vector<std::string>& dirnames);
+        bool watch_children(const std::vector<std::string>& dirnames);
+        bool watch_file(const std::vector<std::string>& filenames);
+
+        bool start()
+        {
+            return _fd != -1;
+        }
+
+        int fd()
+        {
+            return _fd;
+        }
+
+        bool read(change_batch& batch);
+
+        ~fanotify_backend();
+
+    private:
+        /* what a root covers below its path */
+        enum scope { self, children, tree };
+
+        bool mark(const std::string& path, scope covered);
+        bool resolve(const void *info, std::string& path);
+        bool watched(const std::string& path) const;
+
+        int _fd;
+        int _init_errno;
+        std::vector<std::pair<std::string, scope>> _roots;
+        std::unordered_map<uint64_t, int> _mounts;
+};
+
+/*
+ * Periodic rescan of the watched trees, for filesystems without inotify
+ * support (network mounts, some FUSE filesystems).
+ */
+class poll_backend {
+    public:
+        poll_backend();
+
+        void set_interval(unsigned ms)
+        {
+            _interval_ms = ms;
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames);
+        bool watch_children(const std::vector<std::string>& dirnames);
+        bool watch_file(const std::vector<std::string>& filenames);
+        bool start();
+
+        int fd()
+        {
+            return _timer_fd;
+        }
+
+        bool read(change_batch& batch);
+
+        ~poll_backend();
+
+    private:
+        struct entry {
+            int64_t mtime;
+            int64_t size;
+            uint64_t ino;
+            bool dir;
+        };
+        using snapshot = std::unordered_map<std::string, entry>;
+
+        static void add(snapshot& snap, const std::string& path, const struct stat& st);
+        void scan(snapshot& snap) const;
+        void scan(const std::vector<std::string>& dirnames, bool shallow,
+                  snapshot& snap) const;
+
+        int _timer_fd;
+        unsigned _interval_ms;
+        std::vector<std::string> _dirs;
+        /* watched with their entries only */
+        std::vector<std::string> _shallow;
+        std::vector<std::string> _files;
+        snapshot _snapshot;
+};
+
+/*
+ * Replay a recording made with recording_backend, at its original pace
+ * divided by speed (0: as fast as possible). Nothing is watched.
+ */
+class replay_backend {
+    public:
+        replay_backend();
+
+        bool open(const char *filename, double speed);
+
+        bool watch_dir(const std::vector<std::string>&)
+        {
+            return true;
+        }
+
+        bool watch_children(const std::vector<std::string>&)
+        {
+            return true;
+        }
+
+        bool watch_file(const std::vector<std::string>&)
+        {
+            return true;
+        }
+
+        bool start()
+        {
+            return arm(0);
+        }
+
+        int fd()
+        {
+            return _timer_fd;
+        }
+
+        bool read(change_batch& batch);
+
+        const replay_reader& reader() const
+        {
+            return _reader;
+        }
+
+        uint64_t nevents() const
+        {
+            return _nevents;
+        }
+
+        uint64_t nbatches() const
+        {
+            return _nbatches;
+        }
+
+        ~replay_backend();
+
+    private:
+        bool arm(uint64_t delay);
+
+        replay_reader _reader;
+        int _timer_fd;
+        double _speed;
+        change_batch _next;
+        bool _exhausted;
+        uint64_t _nevents;
+        uint64_t _nbatches;
+};
+
+/* Save everything Backend reads, for a later replay_backend. */
+template <typename Backend>
+class recording_backend {
+    public:
+        bool open(const char *filename)
+        {
+            return _recorder.open(filename);
+        }
+
+        Backend& inner()
+        {
+            return _backend;
+        }
+
+        void set_prune(std::vector<std::string> names)
+        {
+            if constexpr (has_prune<Backend>::value)
+                _backend.set_prune(std::move(names));
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            if constexpr (has_skip<Backend>::value)
+                _backend.set_skip(dirnames);
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_dir(dirnames);
+        }
+
+        bool watch_children(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_children(dirnames);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _backend.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            return _backend.start();
+        }
+
+        int fd()
+        {
+            return _backend.fd();
+        }
+
+        bool read(change_batch& batch)
+        {
+            size_t first = batch.size();
+            bool rc = _backend.read(batch);
+
+            if (batch.size() == first)
+                return rc;
+
+            for (size_t i = first; i < batch.size(); ++i)
+                _recorder.add(batch[i]);
+            _recorder.end_batch();
+
+            return rc;
+        }
+
+    private:
+        Backend _backend;
+        recorder _recorder;
+};
+
+#endif /* AUTORUN_BACKEND_H */
@@ -0,0 +1,347 @@
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include "cache.h"
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    int32_t status;
+    uint32_t reserved;
+    /* the stdout of the run, its stderr follows */
+    uint64_t output_size;
+};
+
+constexpr char cache_magic[4] = { 'A', 'R', 'C', 'E' };
+constexpr uint32_t cache_version = 2;
+
+bool result_cache::open(const std::string& dir, uint64_t max_bytes)
+{
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        error(errno, dir);
+        return false;
+    }
+
+    struct stat st;
+
+    if (stat(dir.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) {
+        error(ENOTDIR, dir);
+        return false;
+    }
+
+    _dir = dir;
+    _dev = st.st_dev;
+    _ino = st.st_ino;
+    _max_bytes = max_bytes;
+    return true;
+}
+
+void result_cache::set_inputs(const std::vector<std::string>& dirnames,
+                              const std::vector<std::string>& filenames)
+{
+    _dirs = dirnames;
+    _files = filenames;
+}
+
+/* Whether path, of status st, is the cache directory or one of its entries. */
+bool result_cache::in_cache(const std::string& path, const struct stat& st) const
+{
+    struct stat parent;
+    size_t slash = path.rfind('/');
+
+    if (st.st_dev == _dev && st.st_ino == _ino)
+        return true;
+
+    return slash != std::string::npos && stat(path.substr(0, slash).c_str(), &parent) == 0
+        && parent.st_dev == _dev && parent.st_ino == _ino;
+}
+
+void result_cache::add(const std::string& path, const struct stat& st)
+{
+    uint64_t hash;
+
+    if (S_ISDIR(st.st_mode))
+        hash = 0;
+    else if (S_ISLNK(st.st_mode))
+        hash = 1;
+    else if (!S_ISREG(st.st_mode))
+        return;
+    else if (!_fingerprints.get(path.c_str(), st, hash))
+        hash = 0;
+
+    _inputs[path] = hash;
+}
+
+/* Remove path, and whatever it held, from the inputs and their hashes. */
+void result_cache::forget(const std::string& path)
+{
+    /* "a/..." sorts between "a/" and "a0", '0' following '/' */
+    auto first = _inputs.lower_bound(path + '/'), last = _inputs.lower_bound(path + '0');
+
+    for (auto it = first; it != last; ++it)
+        _fingerprints.forget(it->first);
+    _inputs.erase(first, last);
+
+    _fingerprints.forget(path);
+    _inputs.erase(path);
+}
+
+/* Add the content of dir, but the cache, to the inputs. */
+bool result_cache::scan(const std::string& dir)
+{
+    char *rootname[] = { const_cast<char *>(dir.c_str()), nullptr };
+
+    FTS *root = fts_open(rootname, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+    if (!root) {
+        error(errno, "fts_open");
+        return false;
+    }
+
+    while (FTSENT *file = fts_read(root)) {
+        switch (file->fts_info) {
+            case FTS_D:
+                if (file->fts_statp->st_ino == _ino && file->fts_statp->st_dev == _dev)
+                    fts_set(root, file, FTS_SKIP);
+                else
+                    add(file->fts_path, *file->fts_statp);
+                break;
+            case FTS_F:
+            case FTS_SL:
+            case FTS_SLNONE:
+                add(file->fts_path, *file->fts_statp);
+                break;
+            default:
+                break;
+        }
+    }
+    fts_close(root);
+    return true;
+}
+
+void result_cache::refresh(const change& c)
+{
+    struct stat st;
+
+    if (lstat(c.path.c_str(), &st) == -1) {
+        forget(c.path);
+        return;
+    }
+
+    if (in_cache(c.path, st))
+        return;
+
+    /* a directory already known follows through the changes of its content */
+    if (S_ISDIR(st.st_mode)) {
+        if (!(c.mask & (IN_CREATE | IN_MOVED_TO)) && _inputs.count(c.path))
+            return;
+        forget(c.path);
+        scan(c.path);
+        return;
+    }
+
+    forget(c.path);
+    add(c.path, st);
+}
+
+void result_cache::update(const change_batch& batch)
+{
+    /* the next key() walks everything anyway */
+    if (!_scanned)
+        return;
+
+    for (auto& c: batch) {
+        if (c.mask & IN_Q_OVERFLOW) {
+            _scanned = false;
+            return;
+        }
+        refresh(c);
+    }
+}
+
+bool result_cache::key(const char *cmd, uint64_t& key)
+{
+    if (!_scanned) {
+        struct stat st;
+
+        _inputs.clear();
+        for (auto& dir: _dirs) {
+            if (!scan(dir))
+                return false;
+        }
+        for (auto& file: _files) {
+            if (lstat(file.c_str(), &st) == 0)
+                add(file, st);
+        }
+        _scanned = true;
+
+        /* the files gone while the changes were not followed */
+        _fingerprints.retain([this](const std::string& path) {
+            return _inputs.count(path) != 0;
+        });
+    }
+
+    key = hash_bytes(cmd, std::strlen(cmd));
+    for (auto& input: _inputs) {
+        key = hash_bytes(input.first.data(), input.first.size(), key);
+        key = hash_bytes(&input.second, sizeof(input.second), key);
+    }
+    return true;
+}
+
+std::string result_cache::entry_path(uint64_t key) const
+{
+    char name[20];
+
+    snprintf(name, sizeof(name), "%016" PRIx64, key);
+    return _dir + '/' + name;
+}
+
+bool result_cache::lookup(uint64_t key, int& status, std::string& output, std::string& errors)
+{
+    std::string path = entry_path(key);
+    std::ifstream file{path, std::ios::binary};
+    cache_header hdr;
+
+    if (!file || !file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr))
+        || std::memcmp(hdr.magic, cache_magic, sizeof(hdr.magic))
+        || hdr.version != cache_version || hdr.key != key)
+        return false;
+
+    errors.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+    if (hdr.output_size > errors.size())
+        return false;
+
+    output.assign(errors, 0, hdr.output_size);
+    errors.erase(0, hdr.output_size);
+    status = hdr.status;
+
+    /* the modification time orders the entries for eviction */
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    return true;
+}
+
+void result_cache::store(uint64_t key, int status, const std::string& output,
+                         const std::string& errors)
+{
+    std::string path = entry_path(key);
+    std::string tmp = path + ".tmp";
+    cache_header hdr;
+
+    if (sizeof(hdr) + output.size() + errors.size() > _max_bytes)
+        return;
+
+    std::memcpy(hdr.magic, cache_magic, sizeof(hdr.magic));
+    hdr.version = cache_version;
+    hdr.key = key;
+    hdr.status = status;
+    hdr.reserved = 0;
+    hdr.output_size = output.size();
+
+    {
+        std::ofstream file{tmp, std::ios::binary | std::ios::trunc};
+
+        file.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        file.write(output.data(), output.size());
+        file.write(errors.data(), errors.size());
+        if (!file) {
+            error(errno, tmp);
+            unlink(tmp.c_str());
+            return;
+        }
+    }
+
+    if (rename(tmp.c_str(), path.c_str()) == -1) {
+        error(errno, path);
+        unlink(tmp.c_str());
+        return;
+    }
+
+    evict();
+}
+
+void result_cache::evict()
+{
+    struct entry {
+        int64_t mtime;
+        uint64_t size;
+        std::string path;
+    };
+    std::vector<entry> entries;
+    uint64_t total = 0;
+
+    DIR *d = opendir(_dir.c_str());
+    if (!d)
+        return;
+
+    while (auto dirent = readdir(d)) {
+        std::string path = _dir + '/' + dirent->d_name;
+        struct stat st;
+
+        /* a .tmp is an entry being stored */
+        if (dirent->d_name[0] == '.' || path.compare(path.size() - 4, 4, ".tmp") == 0
+            || stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+            continue;
+
+        entries.push_back({st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec,
+                           static_cast<uint64_t>(st.st_size), std::move(path)});
+        total += st.st_size;
+    }
+    closedir(d);
+
+    if (total <= _max_bytes)
+        return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const entry& a, const entry& b) { return a.mtime < b.mtime; });
+
+    for (auto& e: entries) {
+        if (total <= _max_bytes)
+            break;
+        if (unlink(e.path.c_str()) == 0)
+            total -= e.size;
+    }
+}
+
+int result_cache::run(const char *cmd)
+{
+    std::string output, errors;
+    uint64_t k;
+    int status;
+
+    if (!key(cmd, k)) {
+        status = spawn_cmd(cmd);
+        trace(trace_kind::run, -1, status);
+        return status;
+    }
+
+    if (lookup(k, status, output, errors)) {
+        if (write(STDOUT_FILENO, output.data(), output.size()) == -1
+            || write(STDERR_FILENO, errors.data(), errors.size()) == -1)
+            error(errno, "write");
+        trace(trace_kind::run, -1, status, "cached", 6);
+        return status;
+    }
+
+    status = spawn_captured(cmd, output, errors);
+    trace(trace_kind::run, -1, status);
+
+    if (status == 0)
+        store(k, status, output, errors);
+    return status;
+}
@@ -0,0 +1,82 @@
+#ifndef AUTORUN_CACHE_H
+#define AUTORUN_CACHE_H
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "change.h"
+#include "fingerprint.h"
+
+/*
+ * Results of successful runs, keyed by the command and the content of every
+ * watched file. When the inputs come back to a state already seen, after a
+ * git stash pop or a branch switch, the stored output and status are
+ * replayed instead of running the command again.
+ *
+ * The inputs are walked once, then followed through the changes, which
+ * only stat what changed. Entries are files named after their key in the
+ * cache directory, the least recently used ones are removed once it grows
+ * over max_bytes.
+ */
+class result_cache {
+    public:
+        result_cache()
+            : _dir{}, _dev{0}, _ino{0}, _max_bytes{0}, _dirs{}, _files{}, _inputs{},
+              _scanned{false}, _fingerprints{}
+        {
+        }
+
+        bool open(const std::string& dir, uint64_t max_bytes);
+
+        bool is_open() const
+        {
+            return !_dir.empty();
+        }
+
+        const std::string& dir() const
+        {
+            return _dir;
+        }
+
+        void set_inputs(const std::vector<std::string>& dirnames,
+                        const std::vector<std::string>& filenames);
+
+        /* Follow the changes of batch in the inputs. */
+        void update(const change_batch& batch);
+
+        /*
+         * Run cmd unless its result is known, returns its wait status. The
+         * cache is left out when the inputs cannot be read.
+         */
+        int run(const char *cmd);
+
+    private:
+        bool scan(const std::string& dir);
+        void add(const std::string& path, const struct stat& st);
+        void forget(const std::string& path);
+        void refresh(const change& c);
+        bool in_cache(const std::string& path, const struct stat& st) const;
+        bool key(const char *cmd, uint64_t& key);
+        std::string entry_path(uint64_t key) const;
+        bool lookup(uint64_t key, int& status, std::string& output, std::string& errors);
+        void store(uint64_t key, int status, const std::string& output,
+                   const std::string& errors);
+        void evict();
+
+        std::string _dir;
+        dev_t _dev;
+        ino_t _ino;
+        uint64_t _max_bytes;
+        std::vector<std::string> _dirs;
+        std::vector<std::string> _files;
+        /* the inputs by path, in order, and the hash of their content */
+        std::map<std::string, uint64_t> _inputs;
+        bool _scanned;
+        fingerprint_table _fingerprints;
+};
+
+#endif /* AUTORUN_CACHE_H */
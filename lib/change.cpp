@@ -0,0 +1,149 @@
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#include "change.h"
+#include "fingerprint.h"
+
+/*
+ * Open addressing over the indices of the changes kept so far, the table is
+ * reused from one batch to the next.
+ */
+void coalesce(change_batch& batch)
+{
+    static thread_local std::vector<uint32_t> table;
+    constexpr uint32_t empty = UINT32_MAX;
+    size_t size = 16;
+    size_t out = 0;
+
+    if (batch.size() < 2)
+        return;
+
+    while (size < 2 * batch.size())
+        size *= 2;
+    table.assign(size, empty);
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const std::string& path = batch[i].path;
+        size_t slot = hash_bytes(path.data(), path.size()) & (size - 1);
+        bool merged = false;
+
+        for (; table[slot] != empty; slot = (slot + 1) & (size - 1)) {
+            change& seen = batch[table[slot]];
+
+            if (seen.path == path) {
+                seen.mask |= batch[i].mask;
+                merged = true;
+                break;
+            }
+        }
+
+        if (merged)
+            continue;
+
+        if (out != i) {
+            batch[out].ts = batch[i].ts;
+            batch[out].mask = batch[i].mask;
+            batch[out].path.swap(batch[i].path);
+        }
+        table[slot] = static_cast<uint32_t>(out++);
+    }
+    batch.resize(out);
+}
+
+const char *change_type(uint32_t mask)
+{
+    if (mask & IN_Q_OVERFLOW)
+        return "overflow";
+    if (mask & (IN_CREATE | IN_MOVED_TO))
+        return mask & IN_CREATE ? "create" : "move_to";
+    if (mask & (IN_DELETE | IN_DELETE_SELF))
+        return "delete";
+    if (mask & (IN_MOVED_FROM | IN_MOVE_SELF))
+        return "move_from";
+    if (mask & (IN_MODIFY | IN_CLOSE_WRITE))
+        return "modify";
+    if (mask & IN_ATTRIB)
+        return "attrib";
+    if (mask & IN_IGNORED)
+        return "ignored";
+    return "other";
+}
+
+/* Length of the UTF-8 sequence at p, 0 when it is not a valid one. */
+static size_t utf8_length(const unsigned char *p, const unsigned char *end)
+{
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xbf;
+
+    if (*p < 0x80)
+        return 1;
+    else if (*p >= 0xc2 && *p <= 0xdf)
+        len = 2;
+    else if (*p >= 0xe0 && *p <= 0xef)
+        len = 3;
+    else if (*p >= 0xf0 && *p <= 0xf4)
+        len = 4;
+    else
+        return 0;
+
+    /* no overlong forms, surrogates nor code points past U+10FFFF */
+    if (*p == 0xe0)
+        lo = 0xa0;
+    else if (*p == 0xed)
+        hi = 0x9f;
+    else if (*p == 0xf0)
+        lo = 0x90;
+    else if (*p == 0xf4)
+        hi = 0x8f;
+
+    if (end - p < static_cast<ptrdiff_t>(len) || p[1] < lo || p[1] > hi)
+        return 0;
+    for (size_t i = 2; i < len; ++i) {
+        if (p[i] < 0x80 || p[i] > 0xbf)
+            return 0;
+    }
+    return len;
+}
+
+/* Paths are bytes: those which are not UTF-8 are replaced with U+FFFD. */
+static void append_json_string(std::string& out, const std::string& s)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data());
+    auto end = p + s.size();
+
+    out.push_back('"');
+    while (p < end) {
+        unsigned char c = *p;
+        size_t len = utf8_length(p, end);
+
+        if (len == 0) {
+            out.append("\\ufffd");
+            p++;
+        } else if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+            p++;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out.append(esc);
+            p++;
+        } else {
+            out.append(reinterpret_cast<const char *>(p), len);
+            p += len;
+        }
+    }
+    out.push_back('"');
+}
+
+void append_json(std::string& out, const change& c)
+{
+    out.append("{\"path\":");
+    append_json_string(out, c.path);
+    out.append(",\"type\":\"");
+    out.append(change_type(c.mask));
+    out.append(c.mask & IN_ISDIR ? "\",\"dir\":true}" : "\",\"dir\":false}");
+}
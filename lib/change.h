@@ -0,0 +1,144 @@
+#ifndef AUTORUN_CHANGE_H
+#define AUTORUN_CHANGE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A resolved filesystem event, as seen by everything downstream of the
+ * backend. mask uses the inotify IN_* bits whatever the backend.
+ */
+struct change {
+    uint64_t ts;
+    uint32_t mask;
+    std::string path;
+};
+
+/*
+ * The changes read at once. clear() keeps the changes around: the next
+ * batch reuses their path buffers, so that once warmed up, filling a batch
+ * allocates nothing.
+ */
+class change_batch {
+    public:
+        using value_type = change;
+        using iterator = change *;
+        using const_iterator = const change *;
+
+        change_batch() : _changes{}, _size{0}
+        {
+        }
+
+        /* Append a change with an empty path, to be filled in place. */
+        change& emplace(uint64_t ts, uint32_t mask)
+        {
+            if (_size == _changes.size())
+                _changes.emplace_back();
+
+            change& c = _changes[_size++];
+            c.ts = ts;
+            c.mask = mask;
+            c.path.clear();
+            return c;
+        }
+
+        void push_back(const change& c)
+        {
+            emplace(c.ts, c.mask).path.assign(c.path);
+        }
+
+        /* Move the changes of other to the end of this batch, buffers included. */
+        void append(change_batch& other)
+        {
+            for (auto& c: other)
+                emplace(c.ts, c.mask).path.swap(c.path);
+            other.clear();
+        }
+
+        void clear()
+        {
+            _size = 0;
+        }
+
+        /* Only shrinks, the changes past n are kept for reuse. */
+        void resize(size_t n)
+        {
+            if (n < _size)
+                _size = n;
+        }
+
+        iterator erase(iterator first, iterator last)
+        {
+            std::rotate(first, last, end());
+            _size -= last - first;
+            return first;
+        }
+
+        void reserve(size_t n)
+        {
+            _changes.reserve(n);
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        bool empty() const
+        {
+            return _size == 0;
+        }
+
+        change *data()
+        {
+            return _changes.data();
+        }
+
+        iterator begin()
+        {
+            return _changes.data();
+        }
+
+        iterator end()
+        {
+            return _changes.data() + _size;
+        }
+
+        const_iterator begin() const
+        {
+            return _changes.data();
+        }
+
+        const_iterator end() const
+        {
+            return _changes.data() + _size;
+        }
+
+        change& operator[](size_t i)
+        {
+            return _changes[i];
+        }
+
+        const change& operator[](size_t i) const
+        {
+            return _changes[i];
+        }
+
+    private:
+        std::vector<change> _changes;
+        size_t _size;
+};
+
+/* Merge the changes of a batch that refer to the same path. */
+void coalesce(change_batch& batch);
+
+/* "create", "delete", "modify", "move_from", "move_to", "overflow"... */
+const char *change_type(uint32_t mask);
+
+/* Append c to out as {"path":...,"type":...,"dir":...} */
+void append_json(std::string& out, const change& c);
+
+#endif /* AUTORUN_CHANGE_H */
@@ -0,0 +1,461 @@
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "compdb.h"
+#include "spawner.h"
+#include "util.h"
+
+static void skip_ws(const char *& p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        ++p;
+}
+
+static void append_utf8(std::string& out, uint32_t cp)
+{
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else {
+        out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    }
+}
+
+static bool parse_hex4(const char *& p, const char *end, uint32_t& cp)
+{
+    cp = 0;
+    for (int i = 0; i < 4; ++i, ++p) {
+        if (p >= end)
+            return false;
+
+        char c = *p;
+        cp <<= 4;
+        if (c >= '0' && c <= '9')
+            cp |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            cp |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            cp |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+/* p is on the opening quote, and ends past the closing one. */
+static bool parse_string(const char *& p, const char *end, std::string& out)
+{
+    out.clear();
+    if (p >= end || *p != '"')
+        return false;
+
+    for (++p; p < end; ++p) {
+        if (*p == '"') {
+            ++p;
+            return true;
+        }
+        if (*p != '\\') {
+            out.push_back(*p);
+            continue;
+        }
+
+        if (++p >= end)
+            return false;
+        switch (*p) {
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                uint32_t cp, low;
+
+                ++p;
+                if (!parse_hex4(p, end, cp))
+                    return false;
+                if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\'
+                    && p[1] == 'u') {
+                    p += 2;
+                    if (!parse_hex4(p, end, low))
+                        return false;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(out, cp);
+                --p;
+                break;
+            }
+            default: out.push_back(*p); break;
+        }
+    }
+    return false;
+}
+
+/* Skip a value of any type. */
+static bool skip_value(const char *& p, const char *end)
+{
+    std::string unused;
+    int depth = 0;
+
+    do {
+        skip_ws(p, end);
+        if (p >= end || *p == '\0')
+            return false;
+
+        if (*p == '"') {
+            if (!parse_string(p, end, unused))
+                return false;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+            ++p;
+        } else if (*p == '}' || *p == ']') {
+            depth--;
+            ++p;
+        } else {
+            while (p < end && !std::strchr(",:]} \t\r\n", *p))
+                ++p;
+            if (p < end && (*p == ',' || *p == ':'))
+                ++p;
+        }
+    } while (depth > 0);
+
+    return depth == 0;
+}
+
+/* Split a shell command line into words, for the flags that matter here. */
+static void split_args(const std::string& cmd, std::vector<std::string>& args)
+{
+    std::string word;
+    bool in_word = false;
+    char quote = 0;
+
+    for (size_t i = 0; i < cmd.size(); ++i) {
+        char c = cmd[i];
+
+        if (quote == '\'') {
+            if (c == '\'')
+                quote = 0;
+            else
+                word.push_back(c);
+        } else if (quote == '"') {
+            if (c == '"')
+                quote = 0;
+            else if (c == '\\' && i + 1 < cmd.size() && std::strchr("\"\\$`", cmd[i + 1]))
+                word.push_back(cmd[++i]);
+            else
+                word.push_back(c);
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (in_word)
+                args.push_back(std::move(word));
+            word.clear();
+            in_word = false;
+        } else {
+            in_word = true;
+            if (c == '\'' || c == '"')
+                quote = c;
+            else if (c == '\\' && i + 1 < cmd.size())
+                word.push_back(cmd[++i]);
+            else
+                word.push_back(c);
+        }
+    }
+
+    if (in_word)
+        args.push_back(std::move(word));
+}
+
+/* -MF <file>, or the output with a .d extension for -MD and -MMD alone. */
+static std::string find_depfile(const std::vector<std::string>& args)
+{
+    std::string output;
+    bool md = false;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        auto& a = args[i];
+
+        if (a == "-MF" && i + 1 < args.size())
+            return args[i + 1];
+        if (a.compare(0, 3, "-MF") == 0 && a.size() > 3)
+            return a.substr(3);
+        if (a == "-MD" || a == "-MMD")
+            md = true;
+        else if (a == "-o" && i + 1 < args.size())
+            output = args[i + 1];
+    }
+
+    if (!md || output.empty())
+        return {};
+
+    size_t dot = output.rfind('.');
+    if (dot != std::string::npos && output.find('/', dot) == std::string::npos)
+        output.resize(dot);
+    return output + ".d";
+}
+
+bool compile_db::load(const std::string& path)
+{
+    std::string db = absolute_path(path);
+    mapped_file json;
+
+    if (!json.open(db.c_str())) {
+        error(errno, path);
+        return false;
+    }
+
+    const char *p = json.data(), *end = p + json.size();
+    std::string key, value, dir, file, cmd;
+    std::vector<std::string> args;
+    std::vector<unit> units;
+
+    skip_ws(p, end);
+    if (p >= end || *p++ != '[') {
+        std::cerr << "autorun: " << path << ": not a compilation database\n";
+        return false;
+    }
+
+    while (true) {
+        skip_ws(p, end);
+        if (p < end && *p == ']')
+            break;
+        if (p >= end || *p++ != '{')
+            goto invalid;
+
+        dir.clear();
+        file.clear();
+        cmd.clear();
+        args.clear();
+
+        while (true) {
+            skip_ws(p, end);
+            if (p < end && *p == '}') {
+                ++p;
+                break;
+            }
+            if (!parse_string(p, end, key))
+                goto invalid;
+            skip_ws(p, end);
+            if (p >= end || *p++ != ':')
+                goto invalid;
+            skip_ws(p, end);
+
+            if (key == "arguments" && p < end && *p == '[') {
+                for (++p; ; ) {
+                    skip_ws(p, end);
+                    if (p < end && *p == ']') {
+                        ++p;
+                        break;
+                    }
+                    if (!parse_string(p, end, value))
+                        goto invalid;
+                    args.push_back(value);
+                    skip_ws(p, end);
+                    if (p < end && *p == ',')
+                        ++p;
+                }
+            } else if ((key == "directory" || key == "file" || key == "command")
+                       && p < end && *p == '"') {
+                if (!parse_string(p, end, key == "directory" ? dir : key == "file" ? file : cmd))
+                    goto invalid;
+            } else if (!skip_value(p, end)) {
+                goto invalid;
+            }
+
+            skip_ws(p, end);
+            if (p < end && *p == ',')
+                ++p;
+        }
+
+        if (file.empty() || (cmd.empty() && args.empty()))
+            goto invalid;
+
+        if (cmd.empty()) {
+            for (auto& a: args)
+                append_arg(cmd, a);
+        } else {
+            split_args(cmd, args);
+        }
+
+        dir = normalize_path(db.substr(0, db.rfind('/')), dir);
+
+        unit u{normalize_path(dir, file), dir, "cd", {}};
+        append_arg(u.cmd, dir);
+        u.cmd.append(" && ");
+        u.cmd.append(cmd);
+
+        std::string depfile = find_depfile(args);
+        if (!depfile.empty())
+            u.depfile = normalize_path(dir, depfile);
+        units.push_back(std::move(u));
+
+        skip_ws(p, end);
+        if (p < end && *p == ',')
+            ++p;
+    }
+
+    _path = std::move(db);
+    _units = std::move(units);
+    _files.clear();
+    _depfiles.clear();
+    _depfile_dirs.clear();
+    _index.clear();
+    for (uint32_t u = 0; u < _units.size(); ++u) {
+        auto& depfile = _units[u].depfile;
+
+        _files.emplace(_units[u].file, u);
+        if (!depfile.empty())
+            _depfiles.emplace(depfile, u);
+        update(u);
+    }
+
+    for (auto& depfile: _depfiles)
+        _depfile_dirs.push_back(depfile.first.substr(0, depfile.first.rfind('/')));
+    std::sort(_depfile_dirs.begin(), _depfile_dirs.end());
+    _depfile_dirs.erase(std::unique(_depfile_dirs.begin(), _depfile_dirs.end()),
+                        _depfile_dirs.end());
+    return true;
+
+invalid:
+    std::cerr << "autorun: " << path << ": invalid compilation database\n";
+    return false;
+}
+
+void compile_db::update(uint32_t u)
+{
+    unit& unit = _units[u];
+    mapped_file depfile;
+
+    _deps.clear();
+    _deps.push_back(_index.add_file(unit.file));
+
+    if (!unit.depfile.empty() && depfile.open(unit.depfile.c_str())) {
+        parse_depfile(depfile.data(), depfile.data() + depfile.size(),
+                      [this, &unit](const std::string&, const std::string& dep) {
+                          _deps.push_back(_index.add_file(normalize_path(unit.dir, dep)));
+                      });
+    }
+
+    _index.set_deps(u, _deps);
+}
+
+void compile_db::affected(const change_batch& batch, std::vector<uint32_t>& units)
+{
+    _marks.assign(_units.size(), false);
+
+    for (auto& c: batch) {
+        uint32_t f = _index.find(absolute_path(c.path));
+
+        if (f == dep_index::none)
+            continue;
+
+        for (uint32_t u: _index.users(f)) {
+            if (!_marks[u]) {
+                _marks[u] = true;
+                units.push_back(u);
+            }
+        }
+    }
+}
+
+void compile_db::input_dirs(std::vector<std::string>& dirs) const
+{
+    dirs.push_back(_path.substr(0, _path.rfind('/')));
+
+    /* missing before the first build, they are watched from the next refresh on */
+    for (auto& dir: _depfile_dirs) {
+        if (is_dir(dir.c_str()))
+            dirs.push_back(dir);
+    }
+
+    _index.dirs(dirs);
+}
+
+bool compile_db::refresh(const change_batch& batch, size_t first)
+{
+    bool updated = false;
+
+    for (size_t i = first; i < batch.size(); ++i) {
+        const change& c = batch[i];
+
+        if (!(c.mask & (IN_MODIFY | IN_CREATE | IN_MOVED_TO)))
+            continue;
+        if (c.path == _path)
+            return load(std::string(_path));
+
+        /* rewritten by the compiler, whoever ran it */
+        auto depfile = _depfiles.find(absolute_path(c.path));
+        if (depfile != _depfiles.end()) {
+            update(depfile->second);
+            updated = true;
+        }
+    }
+    return updated;
+}
+
+void compile_scheduler::submit(uint32_t u)
+{
+    _state[_db->file(u)] = state::busy;
+    _jobs.emplace(_next_job, _db->file(u));
+    _pool.submit(_db->command(u), _next_job++);
+}
+
+bool compile_scheduler::operator()(change_batch& batch)
+{
+    _units.clear();
+    _db->affected(batch, _units);
+
+    for (uint32_t u: _units) {
+        auto it = _state.find(_db->file(u));
+
+        if (it == _state.end())
+            submit(u);
+        else
+            it->second = state::again;
+    }
+
+    return true;
+}
+
+bool compile_scheduler::on_readable()
+{
+    _pool.on_readable([this](uint64_t job, int status) {
+        auto it = _jobs.find(job);
+        if (it == _jobs.end())
+            return;
+
+        std::string file = std::move(it->second);
+        _jobs.erase(it);
+
+        auto st = _state.find(file);
+        bool again = st != _state.end() && st->second == state::again;
+        if (st != _state.end())
+            _state.erase(st);
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            std::clog << "autorun: " << file << ": compile failed\n";
+
+        /* gone from the database since */
+        uint32_t u = _db->find(file);
+        if (u == compile_db::none)
+            return;
+
+        _db->update(u);
+        if (again)
+            submit(u);
+    });
+
+    return true;
+}
@@ -0,0 +1,139 @@
+#ifndef AUTORUN_COMPDB_H
+#define AUTORUN_COMPDB_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "change.h"
+#include "depfile.h"
+#include "inputs.h"
+#include "pool.h"
+
+/*
+ * The translation units of a compile_commands.json, and for each file the
+ * units depending on it: their source, and the headers listed in the
+ * depfile the compiler writes with -MD or -MMD (-MF, or the output with a
+ * .d extension). The database is reloaded when it is regenerated, the
+ * depfile of a unit whenever it is written, by autorun or another build.
+ */
+class compile_db : public input_graph {
+    public:
+        static constexpr uint32_t none = UINT32_MAX;
+
+        compile_db()
+            : _path{}, _units{}, _files{}, _depfiles{}, _depfile_dirs{}, _index{}, _marks{},
+              _deps{}
+        {
+        }
+
+        /* Returns false when path cannot be read or parsed. */
+        bool load(const std::string& path);
+
+        size_t size() const
+        {
+            return _units.size();
+        }
+
+        const std::string& file(uint32_t unit) const
+        {
+            return _units[unit].file;
+        }
+
+        /* The unit compiling file, none once it left the database. */
+        uint32_t find(const std::string& file) const
+        {
+            auto it = _files.find(file);
+            return it == _files.end() ? none : it->second;
+        }
+
+        /* The compile command of unit, run from its directory. */
+        const std::string& command(uint32_t unit) const
+        {
+            return _units[unit].cmd;
+        }
+
+        /* Read the depfile of unit again. */
+        void update(uint32_t unit);
+
+        /* Append the units depending on the changes of batch. */
+        void affected(const change_batch& batch, std::vector<uint32_t>& units);
+
+        /*
+         * The directory of the database, then those of the depfiles, the
+         * sources and the headers.
+         */
+        void input_dirs(std::vector<std::string>& dirs) const override;
+
+        bool refresh(const change_batch& batch, size_t first) override;
+
+    private:
+        struct unit {
+            std::string file;
+            std::string dir;
+            std::string cmd;
+            std::string depfile;
+        };
+
+        std::string _path;
+        std::vector<unit> _units;
+        std::unordered_map<std::string, uint32_t> _files;
+        std::unordered_map<std::string, uint32_t> _depfiles;
+        std::vector<std::string> _depfile_dirs;
+        dep_index _index;
+        std::vector<bool> _marks;
+        std::vector<uint32_t> _deps;
+};
+
+/*
+ * Compile the units affected by each batch, several at a time through a
+ * job_pool. A unit changed while it compiles is compiled again once done.
+ * Compiles run asynchronously: the watcher calls on_readable() when fd() is
+ * readable.
+ */
+class compile_scheduler {
+    public:
+        compile_scheduler() : _db{nullptr}, _pool{}, _state{}, _jobs{}, _next_job{0}, _units{}
+        {
+        }
+
+        void set_db(compile_db *db)
+        {
+            _db = db;
+        }
+
+        job_pool& pool()
+        {
+            return _pool;
+        }
+
+        bool start()
+        {
+            return _pool.start();
+        }
+
+        int fd() const
+        {
+            return _pool.fd();
+        }
+
+        bool operator()(change_batch& batch);
+
+        bool on_readable();
+
+    private:
+        enum class state : uint8_t { busy, again };
+
+        void submit(uint32_t unit);
+
+        compile_db *_db;
+        job_pool _pool;
+        /* the units compiling, by file since a reload renumbers them */
+        std::unordered_map<std::string, state> _state;
+        std::unordered_map<uint64_t, std::string> _jobs;
+        uint64_t _next_job;
+        std::vector<uint32_t> _units;
+};
+
+#endif /* AUTORUN_COMPDB_H */
@@ -0,0 +1,350 @@
+#ifndef AUTORUN_CORO_H
+#define AUTORUN_CORO_H
+
+#if __cplusplus < 202002L
+#error "autorun/coro.h requires C++20"
+#endif
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util.h"
+#include "watcher.h"
+
+/*
+ * Coroutine interface: a task does co_await w.next_batch() and gets the next
+ * coalesced batch as a span, valid until its next co_await. Nothing is
+ * allocated per batch: the awaiters live in the coroutine frames and are
+ * linked into the loop intrusively.
+ *
+ * Any loop can drive the awaiters, as long as it provides
+ *
+ *   bool add_reader(int fd, io_waiter *w);
+ *
+ * and calls w->ready(w) once, the next time fd is readable. A fd has one
+ * waiter at a time: add_reader() returns false while another one waits on
+ * it, and the awaiter then resumes at once as if its watcher stopped.
+ * coro_loop is a minimal epoll based loop doing just that, plus timers.
+ */
+
+struct io_waiter {
+    void (*ready)(io_waiter *self);
+};
+
+/* Fire and forget coroutine, its frame is freed when it returns. */
+struct watch_task {
+    struct promise_type {
+        watch_task get_return_object()
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+class coro_loop {
+    public:
+        coro_loop()
+            : _efd{epoll_create1(EPOLL_CLOEXEC)},
+              _timer_fd{timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)},
+              _timer_waiter{{on_timer}, this}, _timer_armed{false},
+              _sleepers{nullptr}, _waiters{}, _running{false}
+        {
+        }
+
+        coro_loop(const coro_loop&) = delete;
+        coro_loop& operator=(const coro_loop&) = delete;
+
+        /*
+         * One shot: w is dropped once it fired and has to be added again.
+         * False when another waiter is already waiting on fd.
+         */
+        bool add_reader(int fd, io_waiter *w)
+        {
+            struct epoll_event event;
+
+            if (!_waiters.emplace(fd, w).second) {
+                error(EBUSY, "add_reader");
+                return false;
+            }
+
+            event.events = EPOLLIN | EPOLLONESHOT;
+            event.data.fd = fd;
+
+            if (epoll_ctl(_efd, EPOLL_CTL_MOD, fd, &event) == -1
+                && (errno != ENOENT || epoll_ctl(_efd, EPOLL_CTL_ADD, fd, &event) == -1)) {
+                error(errno, "epoll_ctl");
+                _waiters.erase(fd);
+                return false;
+            }
+            return true;
+        }
+
+        class sleeper {
+            public:
+                sleeper(coro_loop& loop, uint64_t deadline)
+                    : _loop{loop}, _deadline{deadline}, _handle{}, _next{nullptr}
+                {
+                }
+
+                bool await_ready() const
+                {
+                    return _deadline <= now_ns();
+                }
+
+                void await_suspend(std::coroutine_handle<> h)
+                {
+                    _handle = h;
+                    _loop.add_sleeper(this);
+                }
+
+                void await_resume() const
+                {
+                }
+
+            private:
+                friend class coro_loop;
+
+                coro_loop& _loop;
+                uint64_t _deadline;
+                std::coroutine_handle<> _handle;
+                sleeper *_next;
+        };
+
+        sleeper sleep(uint64_t ns)
+        {
+            return {*this, now_ns() + ns};
+        }
+
+        /* Run until nothing is waiting anymore, or stop() is called. */
+        void run()
+        {
+            struct epoll_event events[64];
+
+            _running = true;
+            while (_running && !_waiters.empty()) {
+                int n = epoll_wait(_efd, events, 64, -1);
+
+                if (n == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    error(errno, "epoll_wait");
+                    return;
+                }
+
+                for (int i = 0; i < n; ++i) {
+                    auto waiter = _waiters.find(events[i].data.fd);
+                    io_waiter *w = waiter->second;
+
+                    _waiters.erase(waiter);
+                    w->ready(w);
+                }
+            }
+        }
+
+        void stop()
+        {
+            _running = false;
+        }
+
+        ~coro_loop()
+        {
+            close(_timer_fd);
+            close(_efd);
+        }
+
+    private:
+        /* sleepers are kept sorted, the timerfd is armed for the first one */
+        void add_sleeper(sleeper *s)
+        {
+            sleeper **p = &_sleepers;
+
+            while (*p && (*p)->_deadline <= s->_deadline)
+                p = &(*p)->_next;
+            s->_next = *p;
+            *p = s;
+
+            if (_sleepers == s)
+                arm();
+        }
+
+        void arm()
+        {
+            struct itimerspec its = {};
+
+            if (!_sleepers)
+                return;
+
+            its.it_value.tv_sec = _sleepers->_deadline / 1000000000;
+            its.it_value.tv_nsec = _sleepers->_deadline % 1000000000;
+            timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+
+            if (!_timer_armed)
+                _timer_armed = add_reader(_timer_fd, &_timer_waiter);
+        }
+
+        static void on_timer(io_waiter *w)
+        {
+            auto loop = static_cast<timer_waiter *>(w)->loop;
+            uint64_t expirations;
+            uint64_t now = now_ns();
+
+            if (read(loop->_timer_fd, &expirations, sizeof(expirations)) == -1
+                && errno != EAGAIN)
+                error(errno, "read");
+
+            loop->_timer_armed = false;
+            while (loop->_sleepers && loop->_sleepers->_deadline <= now) {
+                sleeper *s = loop->_sleepers;
+
+                loop->_sleepers = s->_next;
+                s->_handle.resume();
+            }
+            loop->arm();
+        }
+
+        struct timer_waiter : io_waiter {
+            coro_loop *loop;
+        };
+
+        int _efd;
+        int _timer_fd;
+        timer_waiter _timer_waiter;
+        bool _timer_armed;
+        sleeper *_sleepers;
+        /* the waiter of each fd armed */
+        std::unordered_map<int, io_waiter *> _waiters;
+        bool _running;
+};
+
+/* Scheduler of async_watcher: remembers the batch instead of acting on it. */
+struct batch_sink {
+    change_batch *batch = nullptr;
+
+    bool operator()(change_batch& b)
+    {
+        batch = &b;
+        return true;
+    }
+};
+
+template <typename Loop, typename Backend, typename Filter = accept_all>
+class async_watcher {
+    public:
+        explicit async_watcher(Loop& loop) : _loop{loop}, _watcher{}
+        {
+        }
+
+        watcher<Backend, Filter, batch_sink>& get()
+        {
+            return _watcher;
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return _watcher.watch_dir(dirnames);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _watcher.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            return _watcher.start();
+        }
+
+        /*
+         * Resumes with the next non-empty batch, or with an empty span once
+         * the backend stopped.
+         */
+        class next_batch_awaiter : io_waiter {
+            public:
+                next_batch_awaiter(async_watcher& w)
+                    : io_waiter{on_ready}, _w{w}, _handle{}, _result{}
+                {
+                }
+
+                bool await_ready() const
+                {
+                    return false;
+                }
+
+                /* another awaiter waits on the watcher already: stopped */
+                bool await_suspend(std::coroutine_handle<> h)
+                {
+                    _handle = h;
+                    _result = {};
+                    return _w._loop.add_reader(_w._watcher.fd(), this);
+                }
+
+                std::span<change> await_resume() const
+                {
+                    return _result;
+                }
+
+            private:
+                static void on_ready(io_waiter *self)
+                {
+                    auto a = static_cast<next_batch_awaiter *>(self);
+                    auto& sink = a->_w._watcher.scheduler();
+
+                    sink.batch = nullptr;
+                    if (!a->_w._watcher.on_readable()) {
+                        a->_result = {};
+                    } else if (sink.batch) {
+                        a->_result = {sink.batch->data(), sink.batch->size()};
+                    } else {
+                        /* everything was filtered out, keep waiting */
+                        if (a->_w._loop.add_reader(a->_w._watcher.fd(), a))
+                            return;
+                        a->_result = {};
+                    }
+                    a->_handle.resume();
+                }
+
+                async_watcher& _w;
+                std::coroutine_handle<> _handle;
+                std::span<change> _result;
+        };
+
+        next_batch_awaiter next_batch()
+        {
+            return {*this};
+        }
+
+    private:
+        Loop& _loop;
+        watcher<Backend, Filter, batch_sink> _watcher;
+};
+
+#endif /* AUTORUN_CORO_H */
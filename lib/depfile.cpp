@@ -0,0 +1,258 @@
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+
+#include "depfile.h"
+#include "util.h"
+
+bool mapped_file::open(const char *path)
+{
+    struct stat st;
+
+    if (_map) {
+        munmap(_map, _size);
+        _map = nullptr;
+        _size = 0;
+    }
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+
+    if (st.st_size) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED) {
+            error(errno, "mmap");
+            close(fd);
+            return false;
+        }
+        /* read front to back, once */
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        _map = map;
+        _size = st.st_size;
+    }
+
+    close(fd);
+    return true;
+}
+
+mapped_file::~mapped_file()
+{
+    if (_map)
+        munmap(_map, _size);
+}
+
+void dep_index::clear()
+{
+    _ids.clear();
+    _paths.clear();
+    _users.clear();
+    _deps.clear();
+}
+
+uint32_t dep_index::add_file(const std::string& path)
+{
+    auto res = _ids.emplace(path, _paths.size());
+
+    if (res.second) {
+        _paths.push_back(path);
+        _users.emplace_back();
+    }
+    return res.first->second;
+}
+
+void dep_index::set_deps(uint32_t user, std::vector<uint32_t>& files)
+{
+    if (user >= _deps.size())
+        _deps.resize(user + 1);
+
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    /* only touch the users of the files that came or went */
+    auto& old = _deps[user];
+    std::vector<uint32_t> gone, added;
+
+    std::set_difference(old.begin(), old.end(), files.begin(), files.end(),
+                        std::back_inserter(gone));
+    std::set_difference(files.begin(), files.end(), old.begin(), old.end(),
+                        std::back_inserter(added));
+
+    for (uint32_t f: gone) {
+        auto& users = _users[f];
+        auto it = std::find(users.begin(), users.end(), user);
+
+        if (it != users.end()) {
+            *it = users.back();
+            users.pop_back();
+        }
+    }
+    for (uint32_t f: added)
+        _users[f].push_back(user);
+
+    old.swap(files);
+}
+
+void dep_index::dirs(std::vector<std::string>& out) const
+{
+    std::unordered_set<std::string> seen;
+
+    for (uint32_t f = 0; f < _paths.size(); ++f) {
+        if (_users[f].empty())
+            continue;
+
+        auto& path = _paths[f];
+        std::string dir = path.substr(0, path.rfind('/'));
+        if (dir.empty())
+            dir = "/";
+        if (seen.insert(dir).second && is_dir(dir.c_str()))
+            out.push_back(std::move(dir));
+    }
+}
+
+static bool is_depfile(const std::string& path)
+{
+    return path.size() > 2 && path.compare(path.size() - 2, 2, ".d") == 0;
+}
+
+uint32_t depfile_graph::target(const std::string& name)
+{
+    auto res = _target_ids.emplace(name, _targets.size());
+
+    if (res.second)
+        _targets.push_back(name);
+    return res.first->second;
+}
+
+void depfile_graph::scan(const std::vector<std::string>& dirs)
+{
+    std::vector<char *> roots;
+
+    for (auto& dir: dirs)
+        roots.push_back(const_cast<char *>(dir.c_str()));
+    roots.push_back(nullptr);
+
+    FTS *iter = fts_open(roots.data(), FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+    if (!iter) {
+        error(errno, "fts_open");
+        return;
+    }
+
+    while (FTSENT *entry = fts_read(iter)) {
+        if (entry->fts_info == FTS_D)
+            _build_dirs.insert(absolute_path(entry->fts_path));
+        else if (entry->fts_info == FTS_F && is_depfile(entry->fts_path))
+            update(absolute_path(entry->fts_path));
+        else if (entry->fts_info == FTS_ERR || entry->fts_info == FTS_DNR)
+            error(entry->fts_errno, entry->fts_path);
+    }
+    fts_close(iter);
+}
+
+bool depfile_graph::load(const std::vector<std::string>& dirs)
+{
+    scan(dirs);
+
+    if (_depfiles.empty()) {
+        std::cerr << "autorun: no depfile found\n";
+        return false;
+    }
+    return true;
+}
+
+void depfile_graph::update(const std::string& depfile)
+{
+    mapped_file file;
+    auto& targets = _depfiles[depfile];
+
+    /* the targets the depfile no longer lists lose their prerequisites */
+    _rule.clear();
+    for (uint32_t t: targets)
+        _rule[t];
+
+    if (file.open(depfile.c_str())) {
+        parse_depfile(file.data(), file.data() + file.size(),
+                      [this](const std::string& t, const std::string& dep) {
+                          _rule[target(t)].push_back(_index.add_file(absolute_path(dep)));
+                      });
+    }
+
+    targets.clear();
+    for (auto& rule: _rule) {
+        if (!rule.second.empty())
+            targets.push_back(rule.first);
+        _deps.swap(rule.second);
+        _index.set_deps(rule.first, _deps);
+    }
+
+    if (targets.empty())
+        _depfiles.erase(depfile);
+}
+
+void depfile_graph::goals(const change_batch& batch, std::vector<std::string>& goals)
+{
+    _marks.assign(_targets.size(), false);
+
+    for (auto& c: batch) {
+        uint32_t f = _index.find(absolute_path(c.path));
+
+        if (f == dep_index::none)
+            continue;
+
+        for (uint32_t t: _index.users(f)) {
+            if (!_marks[t]) {
+                _marks[t] = true;
+                goals.push_back(_targets[t]);
+            }
+        }
+    }
+}
+
+void depfile_graph::input_dirs(std::vector<std::string>& dirs) const
+{
+    /* every one, a depfile may be written where there was none yet */
+    dirs.insert(dirs.end(), _build_dirs.begin(), _build_dirs.end());
+    _index.dirs(dirs);
+}
+
+bool depfile_graph::refresh(const change_batch& batch, size_t first)
+{
+    std::vector<std::string> created;
+    bool updated = false;
+
+    for (size_t i = first; i < batch.size(); ++i) {
+        auto& c = batch[i];
+
+        if (c.mask & IN_ISDIR) {
+            /* its depfiles may be written before it is watched */
+            std::string dir = absolute_path(c.path);
+
+            if ((c.mask & (IN_CREATE | IN_MOVED_TO)) && !_build_dirs.count(dir)
+                && _build_dirs.count(dir.substr(0, dir.rfind('/'))))
+                created.push_back(std::move(dir));
+        } else if (is_depfile(c.path)) {
+            update(absolute_path(c.path));
+            updated = true;
+        }
+    }
+
+    if (!created.empty()) {
+        scan(created);
+        updated = true;
+    }
+    return updated;
+}
@@ -0,0 +1,223 @@
+#ifndef AUTORUN_DEPFILE_H
+#define AUTORUN_DEPFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "change.h"
+#include "inputs.h"
+
+/* A file mapped read only, empty files included. */
+class mapped_file {
+    public:
+        mapped_file() : _map{nullptr}, _size{0}
+        {
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        /* Returns false, quietly, when the file cannot be read. */
+        bool open(const char *path);
+
+        const char *data() const
+        {
+            return static_cast<const char *>(_map);
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        ~mapped_file();
+
+    private:
+        void *_map;
+        size_t _size;
+};
+
+/*
+ * Call cb(target, prerequisite) for each prerequisite of each rule of the
+ * Makefile fragment written by `cc -MD` in [p, end): "target: dep dep \",
+ * continued lines, escaped spaces and "$$". The rules without
+ * prerequisites added by -MP call nothing.
+ */
+template <typename F>
+void parse_depfile(const char *p, const char *end, F cb)
+{
+    std::vector<std::string> targets;
+    std::string word;
+    bool in_deps = false;
+
+    for (bool last = false; !last; ) {
+        char c = '\n';
+
+        if (p < end)
+            c = *p++;
+        else
+            last = true;
+
+        if (c == '\\' && p < end) {
+            if (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n')) {
+                p += *p == '\r' ? 2 : 1;
+                c = ' ';
+            } else if (*p == ' ' || *p == '#' || *p == '\\') {
+                word.push_back(*p++);
+                continue;
+            }
+        } else if (c == '$' && p < end && *p == '$') {
+            word.push_back(*p++);
+            continue;
+        } else if (c == ':' && !in_deps && (p >= end || *p == ' ' || *p == '\t'
+                                            || *p == '\n' || *p == '\r')) {
+            if (!word.empty())
+                targets.push_back(word);
+            word.clear();
+            in_deps = true;
+            continue;
+        }
+
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            word.push_back(c);
+            continue;
+        }
+
+        if (!word.empty()) {
+            if (in_deps) {
+                for (auto& t: targets)
+                    cb(t, word);
+            } else {
+                targets.push_back(word);
+            }
+            word.clear();
+        }
+
+        if (c == '\n') {
+            targets.clear();
+            in_deps = false;
+        }
+    }
+}
+
+/*
+ * Reverse dependencies: for each file, the users depending on it, like the
+ * translation units including a header. The dependencies of a user are
+ * replaced as a whole when its depfile changes, leaving the rest of the
+ * index as it is.
+ */
+class dep_index {
+    public:
+        static constexpr uint32_t none = UINT32_MAX;
+
+        dep_index() : _ids{}, _paths{}, _users{}, _deps{}
+        {
+        }
+
+        void clear();
+
+        /* The id of path, added when it is new. */
+        uint32_t add_file(const std::string& path);
+
+        uint32_t find(const std::string& path) const
+        {
+            auto it = _ids.find(path);
+            return it == _ids.end() ? none : it->second;
+        }
+
+        const std::string& path(uint32_t file) const
+        {
+            return _paths[file];
+        }
+
+        size_t files() const
+        {
+            return _paths.size();
+        }
+
+        /* The users of file. */
+        const std::vector<uint32_t>& users(uint32_t file) const
+        {
+            return _users[file];
+        }
+
+        /* Replace the dependencies of user with files. */
+        void set_deps(uint32_t user, std::vector<uint32_t>& files);
+
+        /* Append the directories holding the files used by someone. */
+        void dirs(std::vector<std::string>& out) const;
+
+    private:
+        std::unordered_map<std::string, uint32_t> _ids;
+        std::vector<std::string> _paths;
+        std::vector<std::vector<uint32_t>> _users;
+        std::vector<std::vector<uint32_t>> _deps;
+};
+
+/*
+ * The targets of a Make build and their prerequisites, from the depfiles
+ * found below a few directories (-MMD and the like). A depfile written
+ * again replaces the prerequisites of its own targets only, the rest of
+ * the index is left as it is, and a directory created below them is
+ * scanned for depfiles. Paths are relative to the current directory,
+ * where make runs.
+ */
+class depfile_graph : public input_graph {
+    public:
+        depfile_graph()
+            : _index{}, _targets{}, _target_ids{}, _depfiles{}, _build_dirs{}, _marks{},
+              _rule{}, _deps{}
+        {
+        }
+
+        /* Read every *.d below dirs, returns false if there is none. */
+        bool load(const std::vector<std::string>& dirs);
+
+        /* Read depfile again, a missing one drops its targets. */
+        void update(const std::string& depfile);
+
+        size_t size() const
+        {
+            return _targets.size();
+        }
+
+        /* make, to which the goals are appended */
+        std::string command() const
+        {
+            return "make";
+        }
+
+        /* Append the targets depending on the changes of batch. */
+        void goals(const change_batch& batch, std::vector<std::string>& goals);
+
+        /*
+         * The directories below those given to load(), then those of the
+         * prerequisites.
+         */
+        void input_dirs(std::vector<std::string>& dirs) const override;
+
+        bool refresh(const change_batch& batch, size_t first) override;
+
+    private:
+        uint32_t target(const std::string& name);
+
+        /* Read every *.d below dirs, remembering the directories. */
+        void scan(const std::vector<std::string>& dirs);
+
+        dep_index _index;
+        std::vector<std::string> _targets;
+        std::unordered_map<std::string, uint32_t> _target_ids;
+        /* the targets of each depfile */
+        std::unordered_map<std::string, std::vector<uint32_t>> _depfiles;
+        /* the directories below those given to load(), absolute */
+        std::unordered_set<std::string> _build_dirs;
+        std::vector<bool> _marks;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> _rule;
+        std::vector<uint32_t> _deps;
+};
+
+#endif /* AUTORUN_DEPFILE_H */
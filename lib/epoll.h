@@ -0,0 +1,64 @@
+#ifndef AUTORUN_EPOLL_H
+#define AUTORUN_EPOLL_H
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "util.h"
+
+class epoll {
+    public:
+        epoll() : _efd{}
+        {
+            _efd = epoll_create1(0);
+        }
+
+        bool add(int fd)
+        {
+            struct epoll_event event;
+
+            event.data.fd = fd;
+            event.events = EPOLLIN;
+
+            int rc = epoll_ctl(_efd, EPOLL_CTL_ADD, fd, &event);
+            if (rc)
+                error(errno, "epoll_ctl");
+
+            return rc == 0;
+        }
+
+        /* cb(struct epoll_event *) returns false to stop waiting. */
+        template <typename F>
+        void wait(F cb)
+        {
+            struct epoll_event event[2];
+            bool running = true;
+            int rc = 0;
+
+            while (running) {
+                rc = epoll_wait(_efd, event, 2, -1);
+
+                if (rc == -1 && errno != EINTR) {
+                    error(errno, "epoll_wait");
+                    return;
+                } else if (rc == -1) {
+                    continue;
+                }
+
+                running = cb(event);
+            }
+        }
+
+        ~epoll()
+        {
+            if (close(_efd) == -1)
+                error(errno, "close");
+        }
+
+    private:
+        int _efd;
+};
+
+#endif /* AUTORUN_EPOLL_H */
@@ -0,0 +1,222 @@
+#ifndef AUTORUN_FEED_H
+#define AUTORUN_FEED_H
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Shared memory feed of the changes, published by autorun --publish <name>
+ * in /dev/shm/<name>. This header is all a consumer needs:
+ *
+ *   feed_reader feed;
+ *
+ *   if (!feed.open("autorun"))
+ *       return 1;
+ *   while (feed.wait(-1)) {
+ *       while (auto r = feed.next()) {
+ *           use(r->path(), r->mask);
+ *           if (!feed.valid())
+ *               break;          r was overwritten while in use
+ *       }
+ *   }
+ *
+ * The feed is a ring of variable size records, read in place. The
+ * publisher never waits for the readers: a reader that falls behind by
+ * more than the size of the ring skips to the newest records, and
+ * overruns() counts how many times it did.
+ */
+
+constexpr char feed_magic[4] = { 'A', 'R', 'F', 'D' };
+constexpr uint32_t feed_version = 1;
+
+struct feed_record {
+    uint64_t batch;     /* sequence number of the batch, from 1 */
+    uint64_t ts;        /* CLOCK_MONOTONIC, in nanoseconds */
+    uint32_t mask;      /* IN_* bits, 0 for the padding at the end of the ring */
+    uint32_t len;       /* of path, without its terminating NUL */
+
+    const char *path() const
+    {
+        return reinterpret_cast<const char *>(this + 1);
+    }
+
+    static uint64_t size(uint32_t len)
+    {
+        return (sizeof(feed_record) + len + 1 + 7) & ~uint64_t{7};
+    }
+};
+
+struct alignas(64) feed_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t capacity;                  /* of the ring, in bytes */
+    std::atomic<uint64_t> reserved;     /* end of what is being written */
+    std::atomic<uint64_t> head;         /* end of what was written */
+    std::atomic<uint32_t> futex;        /* bumped after each batch */
+};
+
+/* A record never starts less than a header away from the end of the ring. */
+inline bool feed_wraps(uint64_t capacity, uint64_t pos)
+{
+    return capacity - pos % capacity < sizeof(feed_record);
+}
+
+class feed_reader {
+    public:
+        feed_reader() : _map{nullptr}, _size{0}, _pos{0}, _current{0}, _overruns{0}
+        {
+        }
+
+        feed_reader(const feed_reader&) = delete;
+        feed_reader& operator=(const feed_reader&) = delete;
+
+        /* Start reading from the newest record on. */
+        bool open(const char *name)
+        {
+            struct stat st;
+            int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+            if (fd == -1)
+                return false;
+
+            if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(feed_header)) {
+                close(fd);
+                return false;
+            }
+
+            _size = st.st_size;
+            _map = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (_map == MAP_FAILED) {
+                _map = nullptr;
+                return false;
+            }
+
+            if (std::memcmp(header()->magic, feed_magic, sizeof(feed_magic))
+                || header()->version != feed_version
+                || header()->capacity + sizeof(feed_header) > _size)
+                return false;
+
+            _pos = header()->head.load(std::memory_order_acquire);
+            return true;
+        }
+
+        /* The next record, or nullptr once caught up. */
+        const feed_record *next()
+        {
+            const feed_header *h = header();
+
+            while (true) {
+                uint64_t head = h->head.load(std::memory_order_acquire);
+
+                if (_pos == head)
+                    return nullptr;
+
+                if (head - _pos > h->capacity) {
+                    overrun(head);
+                    return nullptr;
+                }
+
+                uint64_t off = _pos % h->capacity;
+                if (feed_wraps(h->capacity, _pos)) {
+                    _pos += h->capacity - off;
+                    continue;
+                }
+
+                auto r = reinterpret_cast<const feed_record *>(ring() + off);
+                uint32_t mask = r->mask;
+                uint32_t len = r->len;
+
+                _current = _pos;
+                if (!valid() || len > h->capacity) {
+                    overrun(h->head.load(std::memory_order_acquire));
+                    return nullptr;
+                }
+
+                if (mask == 0) {
+                    _pos += h->capacity - off;
+                    continue;
+                }
+
+                _pos += feed_record::size(len);
+                return r;
+            }
+        }
+
+        /* Whether the last record from next() is still intact. */
+        bool valid() const
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return header()->reserved.load(std::memory_order_relaxed)
+                <= _current + header()->capacity;
+        }
+
+        /*
+         * Wait for records to read, up to timeout_ms (-1: forever). Returns
+         * false on timeout or error.
+         */
+        bool wait(int timeout_ms)
+        {
+            const feed_header *h = header();
+            struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+            while (true) {
+                uint32_t seq = h->futex.load(std::memory_order_acquire);
+
+                if (h->head.load(std::memory_order_acquire) != _pos)
+                    return true;
+
+                long rc = syscall(SYS_futex, &h->futex, FUTEX_WAIT, seq,
+                                  timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+                if (rc == -1 && errno != EAGAIN && errno != EINTR)
+                    return false;
+            }
+        }
+
+        uint64_t overruns() const
+        {
+            return _overruns;
+        }
+
+        ~feed_reader()
+        {
+            if (_map)
+                munmap(_map, _size);
+        }
+
+    private:
+        const feed_header *header() const
+        {
+            return static_cast<const feed_header *>(_map);
+        }
+
+        const char *ring() const
+        {
+            return static_cast<const char *>(_map) + sizeof(feed_header);
+        }
+
+        void overrun(uint64_t head)
+        {
+            _overruns++;
+            _pos = head;
+        }
+
+        void *_map;
+        size_t _size;
+        uint64_t _pos;
+        uint64_t _current;
+        uint64_t _overruns;
+};
+
+#endif /* AUTORUN_FEED_H */
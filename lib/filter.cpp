@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUTORUN_X86
+#endif
+
+#include "filter.h"
+#include "fingerprint.h"
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t perfect_set::hash(const char *s, size_t len)
+{
+    /* names have no NUL byte, zero padding keeps short keys distinct */
+    if (len <= 8) {
+        uint64_t word = 0;
+
+        std::memcpy(&word, s, len);
+        return mix(word);
+    }
+
+    return hash_bytes(s, len);
+}
+
+size_t perfect_set::slot(uint64_t h, uint32_t d, unsigned shift)
+{
+    return mix(h ^ (d * 0x9e3779b97f4a7c15ull)) >> shift;
+}
+
+void perfect_set::insert(const std::string& key)
+{
+    if (contains(key.data(), key.size()))
+        return;
+
+    _keys.push_back(key);
+    _max_len = std::max(_max_len, key.size());
+
+    unsigned bits = 1;
+    while ((size_t{1} << bits) < _keys.size() + _keys.size() / 4)
+        bits++;
+    while (!build(bits))
+        bits++;
+}
+
+/*
+ * Keys are spread over buckets, then for the largest buckets first, search
+ * a displacement that puts all of their keys in free slots.
+ */
+bool perfect_set::build(unsigned slot_bits)
+{
+    unsigned bucket_bits = slot_bits > 2 ? slot_bits - 2 : 1;
+    std::vector<std::vector<uint32_t>> buckets(size_t{1} << bucket_bits);
+    std::vector<uint64_t> hashes;
+    std::vector<int32_t> slots(size_t{1} << slot_bits, -1);
+    std::vector<uint32_t> disp(buckets.size(), 0);
+    unsigned bucket_shift = 64 - bucket_bits;
+    unsigned slot_shift = 64 - slot_bits;
+
+    for (uint32_t i = 0; i < _keys.size(); ++i) {
+        uint64_t h = hash(_keys[i].data(), _keys[i].size());
+
+        hashes.push_back(h);
+        buckets[h >> bucket_shift].push_back(i);
+    }
+
+    std::vector<uint32_t> order(buckets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    for (uint32_t b: order) {
+        auto& bucket = buckets[b];
+        uint32_t d;
+
+        if (bucket.empty())
+            break;
+
+        for (d = 0; d < 4096; ++d) {
+            size_t placed = 0;
+
+            for (; placed < bucket.size(); ++placed) {
+                size_t s = slot(hashes[bucket[placed]], d, slot_shift);
+
+                if (slots[s] >= 0)
+                    break;
+                slots[s] = static_cast<int32_t>(bucket[placed]);
+            }
+
+            if (placed == bucket.size())
+                break;
+
+            while (placed--)
+                slots[slot(hashes[bucket[placed]], d, slot_shift)] = -1;
+        }
+
+        if (d == 4096)
+            return false;
+        disp[b] = d;
+    }
+
+    _slots = std::move(slots);
+    _disp = std::move(disp);
+    _bucket_shift = bucket_shift;
+    _slot_shift = slot_shift;
+    return true;
+}
+
+/*
+ * The kernels behind path_set::match(), one set per instruction set,
+ * picked once at startup.
+ *
+ * dirs() looks up every directory component of the path in dirs, and
+ * stores the offset of the last component in base. suffixes() compares the
+ * end of the path with n suffixes.
+ */
+struct filter_kernels {
+    const char *isa;
+    bool (*dirs)(const perfect_set& dirs, const char *p, size_t len, size_t& base);
+    bool (*suffixes)(const path_set::suffix *s, size_t n, const char *p, size_t len);
+};
+
+static void load_tail(const char *p, size_t len, unsigned char tail[16])
+{
+    if (len >= 16) {
+        std::memcpy(tail, p + len - 16, 16);
+    } else {
+        std::memset(tail, 0, 16);
+        std::memcpy(tail + 16 - len, p, len);
+    }
+}
+
+static bool dirs_scalar(const perfect_set& dirs, const char *p, size_t len, size_t& base)
+{
+    size_t start = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] != '/')
+            continue;
+        if (dirs.contains(p + start, i - start))
+            return true;
+        start = i + 1;
+    }
+
+    base = start;
+    return false;
+}
+
+static bool suffixes_scalar(const path_set::suffix *s, size_t n, const char *p, size_t len)
+{
+    unsigned char tail[16];
+
+    load_tail(p, len, tail);
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char diff = 0;
+
+        for (size_t j = 0; j < 16; ++j)
+            diff |= (tail[j] ^ s[i].pattern[j]) & s[i].mask[j];
+        if (!diff)
+            return true;
+    }
+
+    return false;
+}
+
+#ifdef AUTORUN_X86
+
+/*
+ * The slashes of a block are found with a single compare, then the
+ * components they end are looked up one by one.
+ */
+static inline bool dirs_block(const perfect_set& dirs, const char *p, size_t offset,
+                              uint32_t slashes, size_t& start)
+{
+    while (slashes) {
+        size_t i = offset + __builtin_ctz(slashes);
+
+        if (dirs.contains(p + start, i - start))
+            return true;
+        start = i + 1;
+        slashes &= slashes - 1;
+    }
+
+    return false;
+}
+
+__attribute__((target("sse4.2")))
+static bool dirs_sse42(const perfect_set& dirs, const char *p, size_t len, size_t& base)
+{
+    const __m128i slash = _mm_set1_epi8('/');
+    size_t start = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, slash));
+
+        if (dirs_block(dirs, p, i, mask, start))
+            return true;
+    }
+
+    for (; i < len; ++i) {
+        if (p[i] != '/')
+            continue;
+        if (dirs.contains(p + start, i - start))
+            return true;
+        start = i + 1;
+    }
+
+    base = start;
+    return false;
+}
+
+__attribute__((target("sse4.2")))
+static bool suffixes_sse42(const path_set::suffix *s, size_t n, const char *p, size_t len)
+{
+    unsigned char buf[16];
+
+    load_tail(p, len, buf);
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+
+    for (size_t i = 0; i < n; ++i) {
+        __m128i pattern = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i].pattern));
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i].mask));
+
+        if (_mm_testz_si128(_mm_xor_si128(tail, pattern), mask))
+            return true;
+    }
+
+    return false;
+}
+
+__attribute__((target("avx2")))
+static bool dirs_avx2(const perfect_set& dirs, const char *p, size_t len, size_t& base)
+{
+    const __m256i slash = _mm256_set1_epi8('/');
+    size_t start = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, slash));
+
+        if (dirs_block(dirs, p, i, mask, start))
+            return true;
+    }
+
+    for (; i < len; ++i) {
+        if (p[i] != '/')
+            continue;
+        if (dirs.contains(p + start, i - start))
+            return true;
+        start = i + 1;
+    }
+
+    base = start;
+    return false;
+}
+
+/* Two suffixes per compare, the tail of the path is in both lanes. */
+__attribute__((target("avx2")))
+static bool suffixes_avx2(const path_set::suffix *s, size_t n, const char *p, size_t len)
+{
+    unsigned char buf[16];
+    size_t i = 0;
+
+    load_tail(p, len, buf);
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    __m256i tail2 = _mm256_broadcastsi128_si256(tail);
+
+    for (; i + 2 <= n; i += 2) {
+        __m256i pattern = _mm256_set_m128i(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i + 1].pattern)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i].pattern)));
+        __m256i mask = _mm256_set_m128i(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i + 1].mask)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i].mask)));
+        __m256i diff = _mm256_and_si256(_mm256_xor_si256(tail2, pattern), mask);
+        uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(diff, _mm256_setzero_si256()));
+
+        if ((same & 0xffff) == 0xffff || (same >> 16) == 0xffff)
+            return true;
+    }
+
+    if (i < n) {
+        __m128i pattern = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i].pattern));
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s[i].mask));
+
+        return _mm_testz_si128(_mm_xor_si128(tail, pattern), mask);
+    }
+
+    return false;
+}
+
+#endif /* AUTORUN_X86 */
+
+static filter_kernels select_kernels()
+{
+#ifdef AUTORUN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return { "avx2", dirs_avx2, suffixes_avx2 };
+    if (__builtin_cpu_supports("sse4.2"))
+        return { "sse4.2", dirs_sse42, suffixes_sse42 };
+#endif
+    return { "scalar", dirs_scalar, suffixes_scalar };
+}
+
+static const filter_kernels kernels = select_kernels();
+
+const char *path_set::isa()
+{
+    return kernels.isa;
+}
+
+bool path_set::add(const std::string& rule)
+{
+    if (rule.empty() || rule == "/" || rule == "*")
+        return false;
+
+    if (rule.back() == '/') {
+        std::string dir = rule.substr(0, rule.size() - 1);
+
+        if (dir.find_first_of("/*") != std::string::npos)
+            return false;
+        _dirs.insert(dir);
+        return true;
+    }
+
+    if (rule.front() != '*') {
+        if (rule.find_first_of("/*") != std::string::npos)
+            return false;
+        _names.insert(rule);
+        return true;
+    }
+
+    std::string end = rule.substr(1);
+
+    if (end.find_first_of("/*") != std::string::npos)
+        return false;
+
+    if (end.size() > 1 && end[0] == '.' && end.find('.', 1) == std::string::npos) {
+        _extensions.insert(end.substr(1));
+        return true;
+    }
+
+    if (end.size() > 16) {
+        _long_suffixes.push_back(end);
+        return true;
+    }
+
+    suffix s = {};
+    std::memcpy(s.pattern + 16 - end.size(), end.data(), end.size());
+    std::memset(s.mask + 16 - end.size(), 0xff, end.size());
+    _suffixes.push_back(s);
+    return true;
+}
+
+bool path_set::match(const char *path, size_t len, bool dir) const
+{
+    size_t base;
+
+    if (!_dirs.empty()) {
+        if (kernels.dirs(_dirs, path, len, base))
+            return true;
+    } else {
+        auto slash = static_cast<const char *>(memrchr(path, '/', len));
+        base = slash ? slash - path + 1 : 0;
+    }
+
+    const char *name = path + base;
+    size_t name_len = len - base;
+
+    if (dir && _dirs.contains(name, name_len))
+        return true;
+
+    if (_names.contains(name, name_len))
+        return true;
+
+    /* the leading dot of a hidden file does not start an extension */
+    if (!_extensions.empty() && name_len > 1) {
+        auto dot = static_cast<const char *>(memrchr(name + 1, '.', name_len - 1));
+
+        if (dot && _extensions.contains(dot + 1, path + len - dot - 1))
+            return true;
+    }
+
+    if (!_suffixes.empty() && kernels.suffixes(_suffixes.data(), _suffixes.size(), path, len))
+        return true;
+
+    for (auto& s: _long_suffixes) {
+        if (s.size() <= name_len && std::memcmp(path + len - s.size(), s.data(), s.size()) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool add_rule_list(path_set& set, const std::string& rules)
+{
+    size_t start = 0;
+
+    while (start < rules.size()) {
+        size_t end = rules.find(',', start);
+
+        if (end == std::string::npos)
+            end = rules.size();
+        if (!set.add(rules.substr(start, end - start)))
+            return false;
+        start = end + 1;
+    }
+
+    return true;
+}
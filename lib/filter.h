@@ -0,0 +1,158 @@
+#ifndef AUTORUN_FILTER_H
+#define AUTORUN_FILTER_H
+
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "change.h"
+
+/*
+ * Filters decide which changes reach the scheduler:
+ *
+ *   bool operator()(const change& c);  false to drop c
+ */
+
+struct accept_all {
+    bool operator()(const change&) const
+    {
+        return true;
+    }
+};
+
+/*
+ * Set of strings hashed and displaced into a collision free table: a lookup
+ * is two hashes and at most one compare. Names of up to 8 bytes are hashed
+ * as a single word.
+ */
+class perfect_set {
+    public:
+        perfect_set()
+            : _keys{}, _slots{}, _disp{}, _bucket_shift{63}, _slot_shift{63}, _max_len{0}
+        {
+        }
+
+        void insert(const std::string& key);
+
+        bool empty() const
+        {
+            return _keys.empty();
+        }
+
+        bool contains(const char *s, size_t len) const
+        {
+            if (len > _max_len || _keys.empty())
+                return false;
+
+            uint64_t h = hash(s, len);
+            uint32_t d = _disp[h >> _bucket_shift];
+            int32_t i = _slots[slot(h, d, _slot_shift)];
+
+            return i >= 0 && _keys[i].size() == len
+                && std::memcmp(_keys[i].data(), s, len) == 0;
+        }
+
+    private:
+        static uint64_t hash(const char *s, size_t len);
+        static size_t slot(uint64_t h, uint32_t d, unsigned shift);
+        bool build(unsigned slot_bits);
+
+        std::vector<std::string> _keys;
+        std::vector<int32_t> _slots;
+        std::vector<uint32_t> _disp;
+        unsigned _bucket_shift;
+        unsigned _slot_shift;
+        size_t _max_len;
+};
+
+/*
+ * Compiled path rules:
+ *
+ *   *.ext    extension of the file name
+ *   *suffix  any other end of the file name (*~, *.tar.gz)
+ *   dir/     a directory anywhere in the path (build/, .git/)
+ *   name     a file or directory name
+ */
+class path_set {
+    public:
+        path_set() : _names{}, _dirs{}, _extensions{}, _suffixes{}, _long_suffixes{}
+        {
+        }
+
+        /* Returns false if rule is not one of the above. */
+        bool add(const std::string& rule);
+
+        bool empty() const
+        {
+            return _names.empty() && _dirs.empty() && _extensions.empty()
+                && _suffixes.empty() && _long_suffixes.empty();
+        }
+
+        /* dir tells whether the last component of path is a directory. */
+        bool match(const char *path, size_t len, bool dir) const;
+
+        /* Instruction set used by match(): "avx2", "sse4.2" or "scalar". */
+        static const char *isa();
+
+        /*
+         * Suffixes of up to 16 bytes, right aligned in their pattern, mask
+         * covering their bytes. Compared 1 or 2 at a time with the last 16
+         * bytes of the path.
+         */
+        struct suffix {
+            unsigned char pattern[16];
+            unsigned char mask[16];
+        };
+
+    private:
+        perfect_set _names;
+        perfect_set _dirs;
+        perfect_set _extensions;
+        std::vector<suffix> _suffixes;
+        std::vector<std::string> _long_suffixes;
+};
+
+/* Add a comma separated list of rules, returns false on an invalid one. */
+bool add_rule_list(path_set& set, const std::string& rules);
+
+/*
+ * Drop the changes matching an exclude rule, and when there are include
+ * rules, the changes matching none of them. Overflows always go through.
+ */
+class rule_filter {
+    public:
+        rule_filter() : _include{}, _exclude{}
+        {
+        }
+
+        path_set& include()
+        {
+            return _include;
+        }
+
+        path_set& exclude()
+        {
+            return _exclude;
+        }
+
+        bool operator()(const change& c) const
+        {
+            bool dir = c.mask & IN_ISDIR;
+
+            if (c.mask & IN_Q_OVERFLOW)
+                return true;
+            if (!_include.empty() && !_include.match(c.path.data(), c.path.size(), dir))
+                return false;
+            return _exclude.empty() || !_exclude.match(c.path.data(), c.path.size(), dir);
+        }
+
+    private:
+        path_set _include;
+        path_set _exclude;
+};
+
+#endif /* AUTORUN_FILTER_H */
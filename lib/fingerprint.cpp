@@ -0,0 +1,72 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "fingerprint.h"
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    constexpr uint64_t m = 0x9e3779b97f4a7c15ull;
+    auto p = static_cast<const unsigned char *>(data);
+    uint64_t h = seed ^ (len * m);
+
+    /* eight bytes at a time, FNV-1a would go byte per byte */
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t k;
+
+        std::memcpy(&k, p, sizeof(k));
+        h = (h ^ mix(k)) * m;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, len);
+    return mix(h ^ mix(tail));
+}
+
+static int64_t ns(const struct timespec& ts)
+{
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+bool fingerprint_table::get(const char *path, const struct stat& st, uint64_t& hash)
+{
+    auto it = _entries.find(path);
+
+    if (it != _entries.end() && it->second.dev == st.st_dev
+        && it->second.ino == st.st_ino && it->second.size == st.st_size
+        && it->second.mtime == ns(st.st_mtim) && it->second.ctime == ns(st.st_ctim)) {
+        hash = it->second.hash;
+        return true;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    char buf[65536];
+    ssize_t len;
+    hash = 0;
+    while ((len = read(fd, buf, sizeof(buf))) > 0 || (len == -1 && errno == EINTR)) {
+        if (len > 0)
+            hash = hash_bytes(buf, len, hash);
+    }
+    close(fd);
+    if (len == -1)
+        return false;
+
+    _entries[path] = { st.st_dev, st.st_ino, st.st_size,
+                       ns(st.st_mtim), ns(st.st_ctim), hash };
+    return true;
+}
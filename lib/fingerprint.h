@@ -0,0 +1,58 @@
+#ifndef AUTORUN_FINGERPRINT_H
+#define AUTORUN_FINGERPRINT_H
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/* Non cryptographic 64 bits hash, chain calls through seed. */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed = 0);
+
+/*
+ * Content hashes of files, cached along with their stat data so that a
+ * file is only read again once its size, times or inode changed.
+ */
+class fingerprint_table {
+    public:
+        fingerprint_table() : _entries{}
+        {
+        }
+
+        /* Returns false if path cannot be read. */
+        bool get(const char *path, const struct stat& st, uint64_t& hash);
+
+        /* Drop the hash of path, gone. */
+        void forget(const std::string& path)
+        {
+            _entries.erase(path);
+        }
+
+        /* Drop the hashes of the paths keep() returns false for. */
+        template <typename Keep>
+        void retain(Keep keep)
+        {
+            for (auto it = _entries.begin(); it != _entries.end(); ) {
+                if (keep(it->first))
+                    ++it;
+                else
+                    it = _entries.erase(it);
+            }
+        }
+
+    private:
+        struct entry {
+            dev_t dev;
+            ino_t ino;
+            off_t size;
+            int64_t mtime;
+            int64_t ctime;
+            uint64_t hash;
+        };
+
+        std::unordered_map<std::string, entry> _entries;
+};
+
+#endif /* AUTORUN_FINGERPRINT_H */
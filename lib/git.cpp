@@ -0,0 +1,104 @@
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "git.h"
+
+/*
+ * Present while git writes to the index or the work tree. MERGE_HEAD and
+ * the like are left out: they stay around while conflicts are being
+ * resolved by hand, which is when the command is most useful.
+ */
+static const char *const git_markers[] = {
+    "index.lock",
+    "HEAD.lock",
+    "rebase-merge",
+    "rebase-apply",
+};
+
+static bool ends_with_git_dir(const char *path, size_t len)
+{
+    return (len == 4 || (len > 4 && path[len - 5] == '/'))
+        && std::memcmp(path + len - 4, ".git", 4) == 0;
+}
+
+bool is_git_marker(const std::string& path, const std::unordered_set<std::string>& git_dirs)
+{
+    size_t slash = path.rfind('/');
+
+    if (slash == std::string::npos
+        || (!ends_with_git_dir(path.c_str(), slash) && !git_dirs.count(path.substr(0, slash))))
+        return false;
+
+    for (auto marker: git_markers) {
+        if (!std::strcmp(path.c_str() + slash + 1, marker))
+            return true;
+    }
+    return false;
+}
+
+bool in_git_dir(const std::string& path)
+{
+    for (size_t i = path.find(".git"); i != std::string::npos; i = path.find(".git", i + 1)) {
+        size_t end = i + 4;
+
+        if ((i == 0 || path[i - 1] == '/') && (end == path.size() || path[end] == '/'))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * The directory a .git file points to, canonicalized as the backends
+ * report it, or an empty string:
+ *
+ *   gitdir: ../.git/worktrees/feature
+ */
+static std::string read_gitdir(const std::string& dir, const std::string& dotgit)
+{
+    std::ifstream file{dotgit};
+    std::string line;
+    char real[PATH_MAX];
+
+    if (!std::getline(file, line) || line.compare(0, 8, "gitdir: ") != 0)
+        return {};
+
+    std::string gitdir = line.substr(8);
+    if (gitdir.empty())
+        return {};
+    if (gitdir[0] != '/')
+        gitdir = dir + '/' + gitdir;
+
+    return realpath(gitdir.c_str(), real) ? real : std::string{};
+}
+
+void find_git_markers(const std::vector<std::string>& dirnames,
+                      std::unordered_set<std::string>& markers,
+                      std::unordered_set<std::string>& git_dirs)
+{
+    struct stat st;
+
+    for (auto& dir: dirnames) {
+        std::string gitdir = dir + "/.git";
+
+        if (stat(gitdir.c_str(), &st) == -1)
+            continue;
+        if (S_ISREG(st.st_mode)) {
+            gitdir = read_gitdir(dir, gitdir);
+            if (gitdir.empty())
+                continue;
+            git_dirs.insert(gitdir);
+        }
+
+        for (auto marker: git_markers) {
+            std::string path = gitdir + '/' + marker;
+
+            if (access(path.c_str(), F_OK) == 0)
+                markers.insert(std::move(path));
+        }
+    }
+}
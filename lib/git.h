@@ -0,0 +1,241 @@
+#ifndef AUTORUN_GIT_H
+#define AUTORUN_GIT_H
+
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "backend.h"
+#include "change.h"
+#include "util.h"
+
+/* The longest the changes wait for a marker to go, a crashed git leaves it. */
+constexpr uint64_t git_max_hold = 60000000000;
+
+/*
+ * If path is an operation marker in a .git directory, or in one of
+ * git_dirs, see git_backend.
+ */
+bool is_git_marker(const std::string& path, const std::unordered_set<std::string>& git_dirs);
+
+/* Whether path is in, or is, a .git directory. */
+bool in_git_dir(const std::string& path);
+
+/*
+ * Add the markers present in the git directory of each of dirnames. Where
+ * .git is a file, in a worktree or a submodule, the directory it points to
+ * with "gitdir:" is added to git_dirs.
+ */
+void find_git_markers(const std::vector<std::string>& dirnames,
+                      std::unordered_set<std::string>& markers,
+                      std::unordered_set<std::string>& git_dirs);
+
+/*
+ * Hold the changes while git is rewriting the work tree, then pass them
+ * all at once: while a marker like .git/index.lock or .git/rebase-merge
+ * exists, nothing goes through. The changes inside .git are dropped, and
+ * when Backend supports it, the content of .git is not even watched. The
+ * git directory of a worktree or a submodule, found through its .git file,
+ * is watched for the markers alone.
+ *
+ * A marker still there after git_max_hold was left by a crashed git: it is
+ * then ignored, with a message, until it is created again.
+ *
+ * Disabled, it passes everything through.
+ */
+template <typename Backend>
+class git_backend {
+    public:
+        git_backend()
+            : _backend{}, _enabled{false}, _markers{}, _git_dirs{}, _efd{-1}, _timer_fd{-1},
+              _held{}
+        {
+        }
+
+        git_backend(const git_backend&) = delete;
+        git_backend& operator=(const git_backend&) = delete;
+
+        void set_enabled(bool enabled)
+        {
+            _enabled = enabled;
+        }
+
+        Backend& inner()
+        {
+            return _backend;
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            if constexpr (has_skip<Backend>::value)
+                _backend.set_skip(dirnames);
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            if (_enabled) {
+                if constexpr (has_prune<Backend>::value)
+                    _backend.set_prune({".git"});
+                find_git_markers(dirnames, _markers, _git_dirs);
+            }
+            if (!_backend.watch_dir(dirnames))
+                return false;
+
+            std::vector<std::string> git_dirs{_git_dirs.begin(), _git_dirs.end()};
+            return git_dirs.empty() || _backend.watch_children(git_dirs);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _backend.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            if (!_backend.start())
+                return false;
+            if (!_enabled)
+                return true;
+
+            /* the changes of the backend, and the timer of stale markers */
+            _efd = epoll_create1(EPOLL_CLOEXEC);
+            _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (_efd == -1 || _timer_fd == -1) {
+                error(errno, "git");
+                return false;
+            }
+
+            for (int fd: {_backend.fd(), _timer_fd}) {
+                struct epoll_event event;
+
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                if (epoll_ctl(_efd, EPOLL_CTL_ADD, fd, &event) == -1) {
+                    error(errno, "epoll_ctl");
+                    return false;
+                }
+            }
+
+            /* markers found at startup */
+            arm(!_markers.empty());
+            return true;
+        }
+
+        int fd()
+        {
+            return _enabled ? _efd : _backend.fd();
+        }
+
+        bool read(change_batch& batch)
+        {
+            if (!_enabled)
+                return _backend.read(batch);
+
+            size_t first = batch.size();
+            struct epoll_event events[2];
+            int n = epoll_wait(_efd, events, 2, 0);
+            bool held = !_markers.empty();
+            bool rc = true;
+
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd != _timer_fd) {
+                    rc = _backend.read(batch);
+                    continue;
+                }
+
+                uint64_t ticks;
+                if (::read(_timer_fd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN)
+                    error(errno, "read");
+
+                for (auto& marker: _markers)
+                    std::clog << "autorun: " << marker << " left for "
+                        << git_max_hold / 1000000000 << " s, ignoring it\n";
+                _markers.clear();
+            }
+
+            /* the timer may release the held changes */
+            if (batch.size() == first && _held.empty())
+                return rc;
+
+            size_t out = first;
+            for (size_t i = first; i < batch.size(); ++i) {
+                change& c = batch[i];
+
+                if (is_git_marker(c.path, _git_dirs)) {
+                    if (c.mask & (IN_CREATE | IN_MOVED_TO))
+                        _markers.insert(c.path);
+                    else if (c.mask & (IN_DELETE | IN_MOVED_FROM))
+                        _markers.erase(c.path);
+                }
+
+                if (in_git_dir(c.path))
+                    continue;
+
+                if (out != i) {
+                    batch[out].ts = c.ts;
+                    batch[out].mask = c.mask;
+                    batch[out].path.swap(c.path);
+                }
+                out++;
+            }
+            batch.resize(out);
+
+            if (!_markers.empty()) {
+                for (size_t i = first; i < batch.size(); ++i)
+                    _held.push_back(batch[i]);
+                batch.resize(first);
+            } else if (!_held.empty()) {
+                change_batch current;
+
+                for (size_t i = first; i < batch.size(); ++i)
+                    current.push_back(batch[i]);
+                batch.resize(first);
+                batch.append(_held);
+                batch.append(current);
+            }
+
+            if (held != !_markers.empty())
+                arm(!_markers.empty());
+            return rc;
+        }
+
+        ~git_backend()
+        {
+            if (_timer_fd != -1)
+                close(_timer_fd);
+            if (_efd != -1)
+                close(_efd);
+        }
+
+    private:
+        /* Fire once git_max_hold after the first marker appeared. */
+        void arm(bool on)
+        {
+            struct itimerspec its = {};
+
+            if (on)
+                its.it_value.tv_sec = git_max_hold / 1000000000;
+            if (timerfd_settime(_timer_fd, 0, &its, nullptr) == -1)
+                error(errno, "timerfd");
+        }
+
+        Backend _backend;
+        bool _enabled;
+        std::unordered_set<std::string> _markers;
+        /* the git directories out of the trees, reached through a .git file */
+        std::unordered_set<std::string> _git_dirs;
+        int _efd;
+        int _timer_fd;
+        change_batch _held;
+};
+
+#endif /* AUTORUN_GIT_H */
@@ -0,0 +1,286 @@
+#include <sys/stat.h>
+#include <fts.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "inotify.h"
+
+constexpr uint32_t mask = IN_MOVE | IN_MODIFY | IN_CREATE | IN_DELETE;
+
+int inotify::add_watch(const char *path, int parent, const char *name, bool& known)
+{
+    struct stat st;
+
+    if (stat(path, &st) == -1)
+        return -1;
+    if (S_ISDIR(st.st_mode)
+        && std::find(_skip.begin(), _skip.end(), std::make_pair(st.st_dev, st.st_ino))
+           != _skip.end())
+        return skipped;
+
+    uint32_t n = _tree.find(st.st_dev, st.st_ino);
+    known = n != path_tree::none;
+    if (known)
+        return _tree.wd(n);
+
+    int wd = inotify_add_watch(_infd, path, mask);
+    trace(trace_kind::watch, wd, mask, path, std::strlen(path));
+    if (wd < 0)
+        return -1;
+
+    /* the inode behind path was replaced since it was watched */
+    if (node(wd) != path_tree::none)
+        _tree.remove(node(wd));
+
+    uint32_t p = node(parent);
+    n = _tree.add(p, p == path_tree::none ? path : name, st.st_dev, st.st_ino, wd);
+
+    if (static_cast<size_t>(wd) >= _nodes.size()) {
+        _nodes.resize(wd + 1, path_tree::none);
+        _pruned.resize(wd + 1, false);
+    }
+    _nodes[wd] = n;
+
+    const char *base = std::strrchr(name, '/');
+    base = base ? base + 1 : name;
+    _pruned[wd] = S_ISDIR(st.st_mode)
+        && std::find(_prune.begin(), _prune.end(), base) != _prune.end();
+    return wd;
+}
+
+bool inotify::add_file_watch(const std::string& filename)
+{
+    struct stat st;
+
+    if (stat(filename.c_str(), &st) == -1)
+        return false;
+    if (S_ISDIR(st.st_mode))
+        return add_watch(filename);
+
+    size_t slash = filename.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, slash ? slash : 1);
+    std::string name = filename.substr(slash == std::string::npos ? 0 : slash + 1);
+
+    /* the same wd as the directory when it is watched already */
+    int wd = inotify_add_watch(_infd, dir.c_str(), mask);
+    trace(trace_kind::watch, wd, mask, dir.c_str(), dir.size());
+    if (wd < 0)
+        return false;
+
+    _files[wd].emplace_back(std::move(name), filename);
+    return true;
+}
+
+const std::string *inotify::file_path(int wd, const char *name) const
+{
+    auto dir = _files.find(wd);
+
+    if (dir == _files.end())
+        return nullptr;
+    for (auto& file: dir->second) {
+        if (file.first == name)
+            return &file.second;
+    }
+    return nullptr;
+}
+
+void inotify::set_skip(const std::vector<std::string>& dirnames)
+{
+    struct stat st;
+
+    for (auto& dir: dirnames) {
+        if (stat(dir.c_str(), &st) == 0)
+            _skip.emplace_back(st.st_dev, st.st_ino);
+    }
+}
+
+bool inotify::add_child(int parent, const char *name)
+{
+    uint32_t p = node(parent);
+    bool known;
+
+    if (p == path_tree::none)
+        return false;
+    if (pruned(parent))
+        return true;
+
+    _path.clear();
+    _tree.append_path(p, _path);
+    _path.push_back('/');
+    _path.append(name);
+
+    int wd = add_watch(_path.c_str(), parent, name, known);
+    if (wd == skipped)
+        return true;
+    if (wd < 0)
+        return false;
+
+    /* an inode seen elsewhere was moved here, along with its subtree */
+    uint32_t n = node(wd);
+    if (known && n != path_tree::none
+        && (_tree.parent(n) != p || _tree.name(n) != name)) {
+        for (uint32_t a = p; a != path_tree::none; a = _tree.parent(a)) {
+            if (a == n)
+                return true;
+        }
+        _tree.move(n, p, name);
+    }
+
+    return true;
+}
+
+bool inotify::rewatch(int wd)
+{
+    uint32_t n = node(wd);
+    bool known;
+
+    if (n == path_tree::none)
+        return false;
+
+    _path.clear();
+    _tree.append_path(n, _path);
+
+    uint32_t p = _tree.parent(n);
+    int parent = p == path_tree::none ? -1 : _tree.wd(p);
+    size_t name = _path.size() - _tree.name(n).size();
+
+    _nodes[wd] = path_tree::none;
+    _tree.remove(n);
+
+    int rewatched = add_watch(_path.c_str(), parent, _path.c_str() + name, known);
+    if (rewatched < 0)
+        return false;
+
+    /* the subtree watched below the old node goes under the new one */
+    uint32_t m = node(rewatched);
+    if (m != path_tree::none && m != n)
+        _tree.adopt(n, m);
+    return true;
+}
+
+static void traverse(FTS *iter, inotify& in)
+{
+    FTSENT *file;
+    bool known;
+
+    while ((file = fts_read(iter)) != nullptr) {
+        if (file->fts_info == FTS_DP)
+            continue;
+
+        trace(trace_kind::traverse, -1, 0, iter->fts_path, std::strlen(iter->fts_path));
+
+        int parent = file->fts_level > 0 ? static_cast<int>(file->fts_parent->fts_number) : -1;
+        int wd = in.add_watch(file->fts_path, parent, file->fts_name, known);
+        bool res = wd >= 0;
+
+        if (wd == inotify::skipped) {
+            fts_set(iter, file, FTS_SKIP);
+            continue;
+        }
+
+        file->fts_number = wd;
+        /* reached through another root already */
+        if (res && (known || in.pruned(wd)) && file->fts_info == FTS_D)
+            fts_set(iter, file, FTS_SKIP);
+
+        if (!res) {
+            error(errno, "inotify::add_watch", iter->fts_path);
+            return;
+        }
+    }
+
+    if (errno)
+        error(errno, "fts_read");
+}
+
+int watch_dir(const std::vector<std::string>& dirnames, inotify& in)
+{
+    std::vector<char *> rootname;
+    FTS *root;
+
+    if (dirnames.empty())
+        return 0;
+
+    rootname.resize(dirnames.size() + 1);
+    auto iter = rootname.begin();
+    for (auto dir: dirnames)
+        *iter++ = strdup(dir.c_str());
+    *iter = nullptr;
+
+    root = fts_open(&rootname[0], FTS_PHYSICAL | FTS_NOSTAT | FTS_NOCHDIR, nullptr);
+    if (!root) {
+        error(errno, "fts_open");
+        return -1;
+    }
+
+    traverse(root, in);
+    fts_close(root);
+
+    for (auto dir: rootname)
+        free(dir);
+
+    return 0;
+}
+
+bool watch_children(const std::vector<std::string>& dirnames, inotify& in)
+{
+    for (auto& dir: dirnames) {
+        if (!in.add_watch(dir))
+            return false;
+    }
+    return true;
+}
+
+bool watch_file(const std::vector<std::string>& filenames, inotify& in)
+{
+    for (auto& f: filenames) {
+        if (!in.add_file_watch(f))
+            return false;
+    }
+    return true;
+}
+
+bool read_changes(inotify& in, change_batch& batch)
+{
+    /* large enough to drain a burst in a few reads */
+    alignas(struct inotify_event) char buf[65536];
+
+    int rc = read(in.fd(), buf, sizeof(buf));
+    trace(trace_kind::read, in.fd(), rc);
+    if (rc == -1)
+        return errno == EINTR;
+
+    uint64_t ts = now_ns();
+
+    for (char *p = buf; p < buf + rc; ) {
+        auto event = reinterpret_cast<struct inotify_event *>(p);
+        p += sizeof(struct inotify_event) + event->len;
+
+        trace(trace_kind::event, event->wd, event->mask, event->name,
+              strnlen(event->name, event->len));
+
+        const std::string *file = event->len ? in.file_path(event->wd, event->name) : nullptr;
+        if (!file && in.files_only(event->wd))
+            continue;
+
+        change& c = batch.emplace(ts, event->mask);
+        if (file) {
+            c.path.assign(*file);
+        } else {
+            in.append_path(event->wd, c.path);
+            if (event->len) {
+                c.path.push_back('/');
+                c.path.append(event->name);
+            }
+        }
+
+        if (event->mask & IN_IGNORED)
+            in.rewatch(event->wd);
+
+        if (event->len && (event->mask & (IN_CREATE | IN_ISDIR)))
+            in.add_child(event->wd, event->name);
+    }
+
+    return true;
+}
@@ -0,0 +1,157 @@
+#ifndef AUTORUN_INOTIFY_H
+#define AUTORUN_INOTIFY_H
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "change.h"
+#include "trace.h"
+#include "tree.h"
+#include "util.h"
+
+/*
+ * An inotify instance and the tree of what it watches. Each inode is
+ * watched once, whatever the number of paths it is reached by.
+ */
+class inotify {
+    public:
+        /* add_watch() of a directory left out by set_skip() */
+        static constexpr int skipped = -2;
+
+        inotify()
+            : _tree{}, _nodes{}, _pruned{}, _prune{}, _skip{}, _files{}, _path{}, _infd{}
+        {
+            _infd = inotify_init1(0);
+        }
+
+        bool add_watch(const std::string& filename)
+        {
+            return add_watch(filename.c_str());
+        }
+
+        /* Watch filename as a root of its own. */
+        bool add_watch(const char *filename)
+        {
+            bool known;
+            return add_watch(filename, -1, filename, known) != -1;
+        }
+
+        /*
+         * Watch filename through its directory, for the changes to that name
+         * only: the file replaced, on rotation or when saved by a rename, is
+         * still followed, the one renamed away is not.
+         */
+        bool add_file_watch(const std::string& filename);
+
+        /* The file watched as name in the directory of wd, or nullptr. */
+        const std::string *file_path(int wd, const char *name) const;
+
+        /* wd is a directory watched for some of its files only. */
+        bool files_only(int wd) const
+        {
+            return node(wd) == path_tree::none && _files.count(wd);
+        }
+
+        /*
+         * Watch path, the entry name of the directory watched as parent.
+         * Returns the watch descriptor, -1 on error or skipped. known is set
+         * when the inode was already watched, it is then left where it is.
+         */
+        int add_watch(const char *path, int parent, const char *name, bool& known);
+
+        /* name was created in, or moved to, the directory watched as parent. */
+        bool add_child(int parent, const char *name);
+
+        /*
+         * Directories with one of these names are watched, but neither
+         * their content nor what is created in them.
+         */
+        void set_prune(std::vector<std::string> names)
+        {
+            _prune = std::move(names);
+        }
+
+        /* These directories are not watched at all, nor what they hold. */
+        void set_skip(const std::vector<std::string>& dirnames);
+
+        bool pruned(int wd) const
+        {
+            return wd >= 0 && static_cast<size_t>(wd) < _pruned.size() && _pruned[wd];
+        }
+
+        /* The watch of wd was removed, watch its path again. */
+        bool rewatch(int wd);
+
+        int fd()
+        {
+            return _infd;
+        }
+
+        /* Append the path watched as wd to out. */
+        void append_path(int wd, std::string& out)
+        {
+            uint32_t n = node(wd);
+
+            if (n != path_tree::none)
+                _tree.append_path(n, out);
+        }
+
+        size_t size() const
+        {
+            return _tree.size();
+        }
+
+        ~inotify()
+        {
+            for (size_t wd = 0; wd < _nodes.size(); ++wd) {
+                if (_nodes[wd] != path_tree::none)
+                    inotify_rm_watch(_infd, static_cast<int>(wd));
+            }
+            for (auto& dir: _files) {
+                if (node(dir.first) == path_tree::none)
+                    inotify_rm_watch(_infd, dir.first);
+            }
+
+            if (close(_infd) == -1)
+                error(errno, "close");
+        }
+
+    private:
+        uint32_t node(int wd) const
+        {
+            if (wd < 0 || static_cast<size_t>(wd) >= _nodes.size())
+                return path_tree::none;
+            return _nodes[wd];
+        }
+
+        path_tree _tree;
+        std::vector<uint32_t> _nodes;
+        std::vector<bool> _pruned;
+        std::vector<std::string> _prune;
+        std::vector<std::pair<dev_t, ino_t>> _skip;
+        /* the watched names in the directory of a wd, and their paths */
+        std::unordered_map<int, std::vector<std::pair<std::string, std::string>>> _files;
+        std::string _path;
+        int _infd;
+};
+
+/* Watch every directory below dirnames, returns -1 on error. */
+int watch_dir(const std::vector<std::string>& dirnames, inotify& in);
+/* Watch dirnames, and so their entries, but not their subdirectories. */
+bool watch_children(const std::vector<std::string>& dirnames, inotify& in);
+bool watch_file(const std::vector<std::string>& filenames, inotify& in);
+
+/*
+ * Read the pending events of in, keep its watches up to date and append the
+ * resolved changes to batch. Returns false if the inotify fd is unusable.
+ */
+bool read_changes(inotify& in, change_batch& batch);
+
+#endif /* AUTORUN_INOTIFY_H */
@@ -0,0 +1,174 @@
+#ifndef AUTORUN_INPUTS_H
+#define AUTORUN_INPUTS_H
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "backend.h"
+#include "change.h"
+#include "scheduler.h"
+#include "spawner.h"
+
+/*
+ * The inputs of a build, as known from its description: a build graph, a
+ * compilation database. Followed by an input_backend.
+ */
+class input_graph {
+    public:
+        /* The directories holding the inputs. */
+        virtual void input_dirs(std::vector<std::string>& dirs) const = 0;
+
+        /*
+         * Reload what the changes of batch, from first on, make stale.
+         * Returns true when the inputs may have changed.
+         */
+        virtual bool refresh(const change_batch& batch, size_t first) = 0;
+
+    protected:
+        ~input_graph() = default;
+};
+
+/*
+ * Watch the directories holding the inputs of an input_graph instead of
+ * whole trees, and follow the graph as it is reloaded: directories new to
+ * it are watched as they appear.
+ *
+ * Without a graph, it passes everything through.
+ */
+template <typename Backend>
+class input_backend {
+    public:
+        input_backend() : _backend{}, _graph{nullptr}, _watched{}, _dirs{}
+        {
+        }
+
+        void set_graph(input_graph *graph)
+        {
+            _graph = graph;
+        }
+
+        Backend& inner()
+        {
+            return _backend;
+        }
+
+        void set_prune(std::vector<std::string> names)
+        {
+            if constexpr (has_prune<Backend>::value)
+                _backend.set_prune(std::move(names));
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            if constexpr (has_skip<Backend>::value)
+                _backend.set_skip(dirnames);
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_dir(dirnames);
+        }
+
+        bool watch_children(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_children(dirnames);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _backend.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            return (!_graph || watch_inputs()) && _backend.start();
+        }
+
+        int fd()
+        {
+            return _backend.fd();
+        }
+
+        bool read(change_batch& batch)
+        {
+            size_t first = batch.size();
+            bool rc = _backend.read(batch);
+
+            if (_graph && batch.size() != first && _graph->refresh(batch, first))
+                watch_inputs();
+            return rc;
+        }
+
+    private:
+        bool watch_inputs()
+        {
+            std::vector<std::string> added;
+
+            _dirs.clear();
+            _graph->input_dirs(_dirs);
+            for (auto& dir: _dirs) {
+                if (_watched.insert(dir).second)
+                    added.push_back(dir);
+            }
+
+            return added.empty() || _backend.watch_children(added);
+        }
+
+        Backend _backend;
+        input_graph *_graph;
+        std::unordered_set<std::string> _watched;
+        std::vector<std::string> _dirs;
+};
+
+/*
+ * Clear the terminal and build the goals of each batch, the targets whose
+ * inputs changed: the command, by default the one of the Graph, is run
+ * with the goals as extra arguments. Batches changing no input run nothing.
+ * A Graph provides:
+ *
+ *   void goals(const change_batch& batch, std::vector<std::string>& goals);
+ *   std::string command() const;
+ */
+template <typename Graph>
+class goal_scheduler {
+    public:
+        goal_scheduler() : _graph{nullptr}, _cmd{}, _goals{}, _line{}
+        {
+        }
+
+        void set_graph(Graph *graph)
+        {
+            _graph = graph;
+        }
+
+        void set_command(std::string cmd)
+        {
+            _cmd = std::move(cmd);
+        }
+
+        bool operator()(change_batch& batch)
+        {
+            _goals.clear();
+            _graph->goals(batch, _goals);
+            if (_goals.empty())
+                return true;
+
+            _line = _cmd.empty() ? _graph->command() : _cmd;
+            for (auto& goal: _goals)
+                append_arg(_line, goal);
+
+            clear_screen();
+            run_cmd(_line.c_str());
+            return true;
+        }
+
+    private:
+        Graph *_graph;
+        std::string _cmd;
+        std::vector<std::string> _goals;
+        std::string _line;
+};
+
+#endif /* AUTORUN_INPUTS_H */
@@ -0,0 +1,280 @@
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+
+#include "jobs.h"
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+
+/* from linux/ioprio.h */
+constexpr int ioprio_class_shift = 13;
+constexpr int ioprio_class_idle = 3;
+constexpr int ioprio_who_pgrp = 2;
+
+constexpr int background_nice = 10;
+
+bool job_scheduler::add_job(int priority, const std::string& rules, std::string cmd)
+{
+    job j{priority, {}, std::move(cmd), -1, -1, false, false, false};
+
+    if (!add_rule_list(j.rules, rules))
+        return false;
+
+    _jobs.push_back(std::move(j));
+    return true;
+}
+
+bool job_scheduler::start()
+{
+    _efd = epoll_create1(EPOLL_CLOEXEC);
+    if (_efd == -1) {
+        error(errno, "epoll_create1");
+        return false;
+    }
+
+    if (_pressure <= 0)
+        return true;
+
+    if (!_gauge.open())
+        return false;
+
+    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (_timer_fd == -1) {
+        error(errno, "pressure");
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = timer_tag;
+    if (epoll_ctl(_efd, EPOLL_CTL_ADD, _timer_fd, &event) == -1) {
+        error(errno, "epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+bool job_scheduler::operator()(change_batch& batch)
+{
+    for (size_t j = 0; j < _jobs.size(); ++j) {
+        for (auto& c: batch) {
+            if (_jobs[j].rules.empty()
+                || _jobs[j].rules.match(c.path.data(), c.path.size(), c.mask & IN_ISDIR)) {
+                trigger(j);
+                break;
+            }
+        }
+    }
+
+    dispatch();
+    return true;
+}
+
+void job_scheduler::trigger(size_t j)
+{
+    if (_jobs[j].pid != -1) {
+        _jobs[j].again = true;
+    } else if (!_jobs[j].queued) {
+        _jobs[j].queued = true;
+        _queue.push({_jobs[j].priority, j});
+    }
+}
+
+/* Whether the next background job waits for the pressure to drop. */
+bool job_scheduler::under_pressure()
+{
+    if (_pressure <= 0)
+        return false;
+
+    uint64_t now = now_ns();
+    bool held = _held_since != 0;
+    if (!held)
+        _held_since = now;
+
+    if (now - _held_since < pressure_max_hold && _gauge.current() > _pressure) {
+        if (!held)
+            std::clog << "autorun: under pressure, holding the background jobs\n";
+        arm(true);
+        return true;
+    }
+
+    _held_since = 0;
+    if (held)
+        arm(false);
+    return false;
+}
+
+/* Check the pressure every second while a background job waits. */
+void job_scheduler::arm(bool on)
+{
+    struct itimerspec its = {};
+
+    if (on) {
+        its.it_value.tv_sec = 1;
+        its.it_interval.tv_sec = 1;
+    }
+    if (timerfd_settime(_timer_fd, 0, &its, nullptr) == -1)
+        error(errno, "timerfd");
+}
+
+void job_scheduler::dispatch()
+{
+    while (!_queue.empty()) {
+        size_t j = _queue.top().second;
+
+        /* foreground jobs come first in the queue */
+        if (!background(j)) {
+            if (_foreground != none)
+                break;
+            _queue.pop();
+            _jobs[j].queued = false;
+            if (!run(j))
+                continue;
+            _foreground = j;
+
+            if (_background == none || _jobs[_background].stopped)
+                continue;
+            if (!_preempt && _server)
+                _token = _server->acquire();
+            if (_preempt || (_server && !_token)) {
+                signal(_background, SIGSTOP);
+                _jobs[_background].stopped = true;
+            }
+        } else {
+            if (_foreground != none || _background != none || under_pressure())
+                break;
+            _queue.pop();
+            _jobs[j].queued = false;
+            if (run(j))
+                _background = j;
+        }
+    }
+
+    if (_foreground == none && _background != none && _jobs[_background].stopped) {
+        signal(_background, SIGCONT);
+        _jobs[_background].stopped = false;
+    }
+}
+
+bool job_scheduler::run(size_t j)
+{
+    job& job = _jobs[j];
+
+    job.pid = spawn_group(job.cmd.c_str());
+    if (job.pid == -1)
+        return false;
+
+    /*
+     * posix_spawn cannot set these, the whole group is updated instead:
+     * what the job forks from now on inherits them.
+     */
+    if (background(j)) {
+        setpriority(PRIO_PGRP, job.pid, background_nice);
+        syscall(SYS_ioprio_set, ioprio_who_pgrp, job.pid,
+                ioprio_class_idle << ioprio_class_shift);
+    }
+
+    job.pidfd = open_pidfd(job.pid);
+    if (job.pidfd == -1) {
+        reap(j);
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = j;
+    if (epoll_ctl(_efd, EPOLL_CTL_ADD, job.pidfd, &event) == -1) {
+        error(errno, "epoll_ctl");
+        reap(j);
+        return false;
+    }
+
+    return true;
+}
+
+/* Wait for the job, which exited or is about to. */
+void job_scheduler::reap(size_t j)
+{
+    job& job = _jobs[j];
+    int status = -1;
+
+    if (job.stopped)
+        signal(j, SIGCONT);
+
+    while (waitpid(job.pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    trace(trace_kind::run, job.pid, status, job.cmd);
+
+    if (job.pidfd != -1) {
+        epoll_ctl(_efd, EPOLL_CTL_DEL, job.pidfd, nullptr);
+        close(job.pidfd);
+    }
+    job.pid = -1;
+    job.pidfd = -1;
+    job.stopped = false;
+
+    if (_foreground == j) {
+        _foreground = none;
+        if (_token) {
+            _server->release();
+            _token = false;
+        }
+    }
+    if (_background == j)
+        _background = none;
+
+    if (job.again) {
+        job.again = false;
+        trigger(j);
+    }
+}
+
+void job_scheduler::signal(size_t j, int sig)
+{
+    if (kill(-_jobs[j].pid, sig) == -1)
+        error(errno, "kill");
+}
+
+bool job_scheduler::on_readable()
+{
+    struct epoll_event events[8];
+    int n = epoll_wait(_efd, events, 8, 0);
+
+    if (n == -1)
+        return errno == EINTR;
+
+    for (int i = 0; i < n; ++i) {
+        uint64_t ticks;
+
+        if (events[i].data.u64 != timer_tag)
+            reap(events[i].data.u64);
+        else if (::read(_timer_fd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN)
+            error(errno, "read");
+    }
+
+    dispatch();
+    return true;
+}
+
+job_scheduler::~job_scheduler()
+{
+    for (size_t j = 0; j < _jobs.size(); ++j) {
+        if (_jobs[j].pid == -1)
+            continue;
+        signal(j, SIGTERM);
+        reap(j);
+    }
+
+    if (_timer_fd != -1)
+        close(_timer_fd);
+    if (_efd != -1)
+        close(_efd);
+}
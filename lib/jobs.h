@@ -0,0 +1,138 @@
+#ifndef AUTORUN_JOBS_H
+#define AUTORUN_JOBS_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "change.h"
+#include "filter.h"
+#include "jobserver.h"
+#include "pressure.h"
+
+/*
+ * Several commands, each run when a change matches one of its rules.
+ * Triggered jobs wait in a priority queue, lower priorities first:
+ *
+ *  - foreground jobs (priority below background_priority) run one at a
+ *    time, as soon as they are triggered;
+ *  - background jobs run one at a time, niced and with the idle I/O
+ *    priority, only while no foreground job is running or waiting. With
+ *    preemption, a running background job is stopped (SIGSTOP) while a
+ *    foreground job runs, and continued afterwards.
+ *
+ * Under pressure, background jobs wait until it drops, checked every second,
+ * or for pressure_max_hold at most. Foreground jobs never wait.
+ *
+ * With a jobserver, the foreground job runs along a background one only with
+ * a token of it, the background job is stopped as with preemption otherwise:
+ * autorun owns a single slot, that of the job running alone.
+ *
+ * A job triggered while it runs is run again once it is done. Jobs run
+ * asynchronously: the watcher calls on_readable() when fd() is readable,
+ * that is when one of them exited.
+ */
+class job_scheduler {
+    public:
+        static constexpr int background_priority = 10;
+
+        job_scheduler()
+            : _jobs{}, _queue{}, _efd{-1}, _foreground{none}, _background{none},
+              _preempt{false}, _server{nullptr}, _token{false}, _gauge{}, _pressure{0},
+              _timer_fd{-1}, _held_since{0}
+        {
+        }
+
+        job_scheduler(const job_scheduler&) = delete;
+        job_scheduler& operator=(const job_scheduler&) = delete;
+
+        /*
+         * rules is a comma separated list of path rules, see path_set, an
+         * empty list matches every change. Returns false on invalid rules.
+         */
+        bool add_job(int priority, const std::string& rules, std::string cmd);
+
+        void set_preempt(bool preempt)
+        {
+            _preempt = preempt;
+        }
+
+        void set_jobserver(jobserver *server)
+        {
+            _server = server;
+        }
+
+        /* Hold the background jobs while the pressure is above limit percent. */
+        void set_pressure(double limit)
+        {
+            _pressure = limit;
+        }
+
+        bool start();
+
+        int fd() const
+        {
+            return _efd;
+        }
+
+        bool operator()(change_batch& batch);
+
+        /* Reap the jobs that exited and start the next ones. */
+        bool on_readable();
+
+        ~job_scheduler();
+
+    private:
+        static constexpr size_t none = SIZE_MAX;
+        /* the epoll tag of the timer checking the pressure */
+        static constexpr uint64_t timer_tag = UINT64_MAX;
+
+        struct job {
+            int priority;
+            path_set rules;
+            std::string cmd;
+            pid_t pid;
+            int pidfd;
+            bool queued;
+            bool again;
+            bool stopped;
+        };
+
+        bool background(size_t j) const
+        {
+            return _jobs[j].priority >= background_priority;
+        }
+
+        void trigger(size_t j);
+        bool under_pressure();
+        void arm(bool on);
+        void dispatch();
+        bool run(size_t j);
+        void reap(size_t j);
+        void signal(size_t j, int sig);
+
+        using entry = std::pair<int, size_t>;
+
+        std::vector<job> _jobs;
+        std::priority_queue<entry, std::vector<entry>, std::greater<entry>> _queue;
+        int _efd;
+        size_t _foreground;
+        size_t _background;
+        bool _preempt;
+        jobserver *_server;
+        /* taken for the foreground job running along the background one */
+        bool _token;
+        pressure_gauge _gauge;
+        double _pressure;
+        int _timer_fd;
+        /* when a background job started to wait for the pressure to drop */
+        uint64_t _held_since;
+};
+
+#endif /* AUTORUN_JOBS_H */
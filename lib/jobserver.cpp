@@ -0,0 +1,132 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "jobserver.h"
+#include "util.h"
+
+/* the FIFO to remove when autorun is killed, set once */
+static const char *fifo_path;
+static const char *fifo_dir;
+
+/* Only async-signal-safe calls, then die of sig as if it was not caught. */
+static void remove_fifo(int sig)
+{
+    int saved_errno = errno;
+
+    unlink(fifo_path);
+    rmdir(fifo_dir);
+    raise(sig); /* SA_RESETHAND restored the default action */
+    errno = saved_errno;
+}
+
+/* Remove the FIFO on the signals that usually end autorun, unless ignored. */
+static void remove_fifo_on_signals(const std::string& path, const std::string& dir)
+{
+    struct sigaction sa, old;
+
+    fifo_path = path.c_str();
+    fifo_dir = dir.c_str();
+
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = remove_fifo;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESETHAND;
+
+    for (int sig: { SIGINT, SIGTERM, SIGHUP }) {
+        if (sigaction(sig, nullptr, &old) == 0 && old.sa_handler == SIG_DFL)
+            sigaction(sig, &sa, nullptr);
+    }
+}
+
+bool jobserver::start(unsigned slots)
+{
+    const char *tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/autorun-XXXXXX";
+
+    if (!mkdtemp(&dir[0])) {
+        error(errno, "mkdtemp");
+        return false;
+    }
+    _dir = dir;
+    _path = dir + "/jobserver";
+
+    if (mkfifo(_path.c_str(), 0600) == -1) {
+        error(errno, "mkfifo");
+        return false;
+    }
+    remove_fifo_on_signals(_path, _dir);
+
+    /* read and write: the FIFO never sees its last writer go */
+    _fd = open(_path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (_fd == -1) {
+        error(errno, _path);
+        return false;
+    }
+
+    std::string tokens(slots > 1 ? slots - 1 : 0, '+');
+    if (!tokens.empty() && write(_fd, tokens.data(), tokens.size()) == -1) {
+        error(errno, "write");
+        return false;
+    }
+
+    /* clients look for the last --jobserver-auth */
+    const char *flags = std::getenv("MAKEFLAGS");
+    std::string makeflags = flags ? flags : "";
+
+    if (!makeflags.empty())
+        makeflags.push_back(' ');
+    makeflags += "-j" + std::to_string(slots) + " --jobserver-auth=fifo:" + _path;
+    return setenv("MAKEFLAGS", makeflags.c_str(), 1) == 0;
+}
+
+bool jobserver::acquire()
+{
+    char token;
+
+    while (true) {
+        ssize_t len = read(_fd, &token, 1);
+
+        if (len == 1) {
+            _tokens.push_back(token);
+            return true;
+        }
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1 && errno != EAGAIN)
+            error(errno, "read");
+        return false;
+    }
+}
+
+void jobserver::release()
+{
+    if (_tokens.empty())
+        return;
+
+    char token = _tokens.back();
+    _tokens.pop_back();
+
+    while (write(_fd, &token, 1) == -1) {
+        if (errno != EINTR) {
+            error(errno, "write");
+            return;
+        }
+    }
+}
+
+jobserver::~jobserver()
+{
+    if (_fd != -1)
+        close(_fd);
+    if (!_path.empty())
+        unlink(_path.c_str());
+    if (!_dir.empty())
+        rmdir(_dir.c_str());
+}
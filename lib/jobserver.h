@@ -0,0 +1,48 @@
+#ifndef AUTORUN_JOBSERVER_H
+#define AUTORUN_JOBSERVER_H
+
+#include <string>
+#include <vector>
+
+/*
+ * A GNU make jobserver shared by everything autorun runs: a FIFO holding
+ * one token per job slot but the one each client owns implicitly, named in
+ * MAKEFLAGS as --jobserver-auth=fifo:<path> (make 4.4, ninja 1.13). A make
+ * or ninja started by autorun, without a -j of its own, takes its extra
+ * jobs from it, and so does the job_pool of autorun.
+ */
+class jobserver {
+    public:
+        jobserver() : _dir{}, _path{}, _fd{-1}, _tokens{}
+        {
+        }
+
+        jobserver(const jobserver&) = delete;
+        jobserver& operator=(const jobserver&) = delete;
+
+        /* Create the FIFO with slots - 1 tokens and export it in MAKEFLAGS. */
+        bool start(unsigned slots);
+
+        /* Readable when a token might be available. */
+        int fd() const
+        {
+            return _fd;
+        }
+
+        /* Take a token without blocking, false if there is none. */
+        bool acquire();
+
+        /* Give back a token taken by acquire(). */
+        void release();
+
+        ~jobserver();
+
+    private:
+        std::string _dir;
+        std::string _path;
+        int _fd;
+        /* make tells its tokens apart, give back the ones taken */
+        std::vector<char> _tokens;
+};
+
+#endif /* AUTORUN_JOBSERVER_H */
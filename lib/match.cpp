@@ -0,0 +1,177 @@
+#include <cctype>
+#include <cstring>
+#include <iostream>
+
+#include "match.h"
+
+/*
+ * The longest literal of each top level alternative of the extended regex
+ * re, false when one of them has none. Groups, brackets, escapes of
+ * classes and quantified characters end a literal.
+ */
+static bool required_literals(const std::string& re, std::vector<std::string>& literals)
+{
+    std::string run, best;
+    int depth = 0;
+
+    for (size_t i = 0; i <= re.size(); ++i) {
+        char c = i < re.size() ? re[i] : '|';
+
+        if (c == '|' && depth == 0) {
+            if (run.size() > best.size())
+                best = run;
+            if (best.empty())
+                return false;
+            literals.push_back(std::move(best));
+            best.clear();
+            run.clear();
+            continue;
+        }
+
+        bool literal = false;
+        switch (c) {
+            case '\\':
+                if (++i < re.size() && !std::isalnum(static_cast<unsigned char>(re[i]))) {
+                    c = re[i];
+                    literal = depth == 0;
+                }
+                break;
+            case '[':
+                /* a ] right after [ or [^ is part of the set */
+                i += i + 1 < re.size() && re[i + 1] == '^' ? 2 : 1;
+                if (i < re.size() && re[i] == ']')
+                    ++i;
+                while (i < re.size() && re[i] != ']') {
+                    /* [:digit:], [=e=] and [.-.] end with a ] of their own */
+                    if (re[i] == '[' && i + 1 < re.size()
+                        && (re[i + 1] == ':' || re[i + 1] == '=' || re[i + 1] == '.')) {
+                        size_t close = re.find(std::string{re[i + 1], ']'}, i + 2);
+                        if (close == std::string::npos)
+                            return false;
+                        i = close + 2;
+                        continue;
+                    }
+                    ++i;
+                }
+                break;
+            case '(':
+                depth++;
+                break;
+            case ')':
+                depth--;
+                break;
+            case '{':
+                while (i < re.size() && re[i] != '}')
+                    ++i;
+                break;
+            case '*':
+            case '?':
+            case '.':
+            case '^':
+            case '$':
+            case '+':
+            case '|':
+                break;
+            default:
+                literal = depth == 0;
+                break;
+        }
+
+        /* a character made optional by a quantifier is not required */
+        if (literal && !(i + 1 < re.size() && std::strchr("*?{", re[i + 1]))) {
+            run.push_back(c);
+            continue;
+        }
+
+        if (run.size() > best.size())
+            best = run;
+        run.clear();
+    }
+
+    return true;
+}
+
+bool line_matcher::compile(const std::string& pattern)
+{
+    int rc = regcomp(&_re, pattern.c_str(), REG_EXTENDED | REG_NOSUB | REG_NEWLINE);
+
+    if (rc) {
+        char msg[256];
+
+        regerror(rc, &_re, msg, sizeof(msg));
+        std::cerr << "autorun: " << pattern << ": " << msg << '\n';
+        return false;
+    }
+    _compiled = true;
+
+    if (!required_literals(pattern, _literals))
+        _literals.clear();
+    return true;
+}
+
+bool line_matcher::matches(const char *line, const char *eol) const
+{
+    regmatch_t range;
+
+    /* the line in place, without its newline nor a copy */
+    range.rm_so = 0;
+    range.rm_eo = eol - line;
+    return regexec(&_re, line, 1, &range, REG_STARTEND) == 0;
+}
+
+size_t line_matcher::scan(const char *p, const char *end, std::string& out) const
+{
+    auto last = static_cast<const char *>(memrchr(p, '\n', end - p));
+
+    if (!last)
+        return 0;
+
+    const char *stop = last + 1;
+
+    if (_literals.empty()) {
+        for (const char *line = p; line < stop; ) {
+            auto eol = static_cast<const char *>(std::memchr(line, '\n', stop - line));
+
+            if (matches(line, eol))
+                out.append(line, eol + 1);
+            line = eol + 1;
+        }
+        return stop - p;
+    }
+
+    /* the next occurrence of each literal from pos, null once there is none */
+    std::vector<const char *> next(_literals.size(), p);
+
+    for (const char *pos = p; pos < stop; ) {
+        const char *hit = nullptr;
+
+        for (size_t i = 0; i < _literals.size(); ++i) {
+            auto& literal = _literals[i];
+
+            if (next[i] && (next[i] < pos || pos == p))
+                next[i] = static_cast<const char *>(memmem(pos, stop - pos, literal.data(),
+                                                           literal.size()));
+            if (next[i] && (!hit || next[i] < hit))
+                hit = next[i];
+        }
+
+        if (!hit)
+            break;
+
+        auto line = static_cast<const char *>(memrchr(pos, '\n', hit - pos));
+        auto eol = static_cast<const char *>(std::memchr(hit, '\n', stop - hit));
+
+        line = line ? line + 1 : pos;
+        if (matches(line, eol))
+            out.append(line, eol + 1);
+        pos = eol + 1;
+    }
+
+    return stop - p;
+}
+
+line_matcher::~line_matcher()
+{
+    if (_compiled)
+        regfree(&_re);
+}
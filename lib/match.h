@@ -0,0 +1,52 @@
+#ifndef AUTORUN_MATCH_H
+#define AUTORUN_MATCH_H
+
+#include <regex.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Find the lines matching an extended regular expression in a stream of
+ * text. Before the regex, the literals found in every alternative of the
+ * pattern ("ERROR|FATAL" has two) are searched with memmem(): only the
+ * lines holding one of them go through regexec(), the others are skipped
+ * without being looked at line by line. Patterns without such literals
+ * run the regex on every line.
+ */
+class line_matcher {
+    public:
+        line_matcher() : _re{}, _compiled{false}, _literals{}
+        {
+        }
+
+        line_matcher(const line_matcher&) = delete;
+        line_matcher& operator=(const line_matcher&) = delete;
+
+        /* Returns false, with a message, when pattern is invalid. */
+        bool compile(const std::string& pattern);
+
+        bool empty() const
+        {
+            return !_compiled;
+        }
+
+        /*
+         * Append to out the matching lines of [p, end), newline included,
+         * p being the start of a line. Returns the length of the complete
+         * lines, the rest is to be scanned again once completed.
+         */
+        size_t scan(const char *p, const char *end, std::string& out) const;
+
+        ~line_matcher();
+
+    private:
+        bool matches(const char *line, const char *eol) const;
+
+        regex_t _re;
+        bool _compiled;
+        std::vector<std::string> _literals;
+};
+
+#endif /* AUTORUN_MATCH_H */
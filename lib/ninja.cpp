@@ -0,0 +1,304 @@
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "ninja.h"
+#include "spawner.h"
+#include "util.h"
+
+static bool run_tool(const std::string& dir, const char *tool, std::string& output)
+{
+    std::string cmd = "ninja -C";
+
+    append_arg(cmd, dir);
+    cmd.append(" -t ");
+    cmd.append(tool);
+
+    int status = spawn_output(cmd.c_str(), output);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        std::cerr << "autorun: " << cmd << " failed\n";
+        return false;
+    }
+    return true;
+}
+
+/* The content of the first "..." of line from pos, pos is moved past it. */
+static bool quoted(const std::string& line, size_t& pos, std::string& out)
+{
+    size_t start = line.find('"', pos);
+    if (start == std::string::npos)
+        return false;
+
+    size_t end = line.find('"', start + 1);
+    if (end == std::string::npos)
+        return false;
+
+    out.assign(line, start + 1, end - start - 1);
+    pos = end + 1;
+    return true;
+}
+
+bool build_graph::load(const std::string& build_dir)
+{
+    char real[PATH_MAX];
+    std::string dot, deps;
+
+    if (!realpath(build_dir.c_str(), real)) {
+        error(errno, build_dir);
+        return false;
+    }
+
+    std::string dir = real;
+    if (!run_tool(dir, "graph", dot) || !run_tool(dir, "deps", deps))
+        return false;
+
+    _dir = std::move(dir);
+    _manifest = _dir + "/build.ninja";
+    _deps_log = _dir + "/.ninja_deps";
+    _nodes.clear();
+    _files.clear();
+
+    if (!parse_graph(dot)) {
+        std::cerr << "autorun: " << _dir << ": cannot parse the build graph\n";
+        return false;
+    }
+    parse_deps(deps);
+    return true;
+}
+
+bool build_graph::load_deps()
+{
+    std::string deps;
+
+    if (!run_tool(_dir, "deps", deps))
+        return false;
+
+    for (auto& n: _nodes)
+        n.deps_next.clear();
+    parse_deps(deps);
+    return true;
+}
+
+uint32_t build_graph::file(const std::string& name)
+{
+    auto res = _files.emplace(normalize_path(_dir, name), _nodes.size());
+
+    if (res.second)
+        _nodes.push_back({name, {}, {}, none, false, false});
+    return res.first->second;
+}
+
+uint32_t build_graph::add_build(bool phony)
+{
+    _nodes.push_back({{}, {}, {}, none, true, phony});
+    return static_cast<uint32_t>(_nodes.size() - 1);
+}
+
+/*
+ * The graphviz output of ninja: files are boxes, and builds with a single
+ * input and output are a labelled edge between them:
+ *
+ *   "0x1" [label="foo.o"]
+ *   "0x2" -> "0x1" [label=" cxx"]
+ *
+ * Other builds are ellipses, linked to their outputs and from their
+ * inputs, dotted for order-only inputs:
+ *
+ *   "0x3" [label="link", shape=ellipse]
+ *   "0x3" -> "0x4"
+ *   "0x1" -> "0x3" [arrowhead=none]
+ */
+bool build_graph::parse_graph(const std::string& dot)
+{
+    std::unordered_map<std::string, uint32_t> ids;
+    std::string id, other, label;
+
+    /* the nodes first, edges can come before the nodes they link */
+    for (size_t pos = 0, end; pos < dot.size(); pos = end + 1) {
+        end = dot.find('\n', pos);
+        if (end == std::string::npos)
+            end = dot.size();
+
+        std::string line = dot.substr(pos, end - pos);
+        size_t i = 0;
+
+        if (line.find(" -> ") != std::string::npos || line.find("[label=") == std::string::npos
+            || !quoted(line, i, id) || !quoted(line, i, label))
+            continue;
+
+        if (line.find("shape=ellipse", i) != std::string::npos)
+            ids[id] = add_build(label == "phony");
+        else
+            ids[id] = file(label);
+    }
+
+    for (size_t pos = 0, end; pos < dot.size(); pos = end + 1) {
+        end = dot.find('\n', pos);
+        if (end == std::string::npos)
+            end = dot.size();
+
+        std::string line = dot.substr(pos, end - pos);
+        size_t i = 0;
+
+        if (line.find(" -> ") == std::string::npos || !quoted(line, i, id)
+            || !quoted(line, i, other))
+            continue;
+
+        auto from = ids.find(id), to = ids.find(other);
+        if (from == ids.end() || to == ids.end())
+            return false;
+
+        uint32_t in = from->second, out = to->second;
+        bool order_only = line.find("style=dotted", i) != std::string::npos;
+
+        if (!_nodes[in].build && !_nodes[out].build) {
+            uint32_t b = add_build(line.find("label=\" phony\"", i) != std::string::npos);
+
+            _nodes[in].next.push_back(b);
+            _nodes[b].next.push_back(out);
+            _nodes[out].producer = b;
+        } else if (_nodes[in].build) {
+            _nodes[in].next.push_back(out);
+            _nodes[out].producer = in;
+        } else if (!order_only) {
+            _nodes[in].next.push_back(out);
+        }
+    }
+
+    return !_nodes.empty();
+}
+
+/*
+ *   foo.o: #deps 2, deps mtime 1700000000 (VALID)
+ *       ../foo.c
+ *       ../foo.h
+ */
+void build_graph::parse_deps(const std::string& text)
+{
+    uint32_t target = none;
+
+    for (size_t pos = 0, end; pos < text.size(); pos = end + 1) {
+        end = text.find('\n', pos);
+        if (end == std::string::npos)
+            end = text.size();
+
+        if (end == pos)
+            continue;
+
+        if (text[pos] != ' ') {
+            size_t colon = text.find(": #deps ", pos);
+
+            target = none;
+            if (colon < end) {
+                auto it = _files.find(normalize_path(_dir, text.substr(pos, colon - pos)));
+                if (it != _files.end())
+                    target = _nodes[it->second].producer;
+            }
+            continue;
+        }
+
+        if (target == none)
+            continue;
+
+        size_t start = text.find_first_not_of(' ', pos);
+        if (start >= end)
+            continue;
+
+        uint32_t dep = file(text.substr(start, end - start));
+        _nodes[dep].deps_next.push_back(target);
+    }
+}
+
+void build_graph::input_dirs(std::vector<std::string>& dirs) const
+{
+    std::unordered_set<std::string> seen{_dir};
+
+    dirs.push_back(_dir);
+    for (auto& f: _files) {
+        if (_nodes[f.second].producer != none)
+            continue;
+
+        std::string dir = f.first.substr(0, f.first.rfind('/'));
+        if (dir.empty())
+            dir = "/";
+        if (seen.insert(dir).second && is_dir(dir.c_str()))
+            dirs.push_back(std::move(dir));
+    }
+}
+
+bool build_graph::refresh(const change_batch& batch, size_t first)
+{
+    bool manifest = false, deps = false;
+
+    for (size_t i = first; i < batch.size(); ++i) {
+        if (!(batch[i].mask & (IN_MODIFY | IN_CREATE | IN_MOVED_TO)))
+            continue;
+        if (batch[i].path == _manifest)
+            manifest = true;
+        else if (batch[i].path == _deps_log)
+            deps = true;
+    }
+
+    if (manifest)
+        return load(_dir);
+    if (deps)
+        return load_deps();
+    return false;
+}
+
+void build_graph::goals(const change_batch& batch, std::vector<std::string>& goals)
+{
+    std::vector<uint32_t> stack;
+
+    if (_marks.size() < _nodes.size())
+        _marks.resize(_nodes.size(), 0);
+    if (++_epoch == 0) {
+        std::fill(_marks.begin(), _marks.end(), 0);
+        _epoch = 1;
+    }
+
+    for (auto& c: batch) {
+        auto it = _files.find(absolute_path(c.path));
+
+        if (it != _files.end() && _nodes[it->second].producer == none
+            && _marks[it->second] != _epoch) {
+            _marks[it->second] = _epoch;
+            stack.push_back(it->second);
+        }
+    }
+
+    while (!stack.empty()) {
+        uint32_t n = stack.back();
+        bool final = true;
+
+        stack.pop_back();
+        for (auto next: {&_nodes[n].next, &_nodes[n].deps_next}) {
+            for (uint32_t m: *next) {
+                if (_nodes[m].phony)
+                    continue;
+                final = false;
+                if (_marks[m] != _epoch) {
+                    _marks[m] = _epoch;
+                    stack.push_back(m);
+                }
+            }
+        }
+
+        if (final && !_nodes[n].build && _nodes[n].producer != none)
+            goals.push_back(_nodes[n].name);
+    }
+}
+
+std::string build_graph::command() const
+{
+    std::string cmd = "ninja -C";
+
+    append_arg(cmd, _dir);
+    return cmd;
+}
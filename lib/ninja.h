@@ -0,0 +1,98 @@
+#ifndef AUTORUN_NINJA_H
+#define AUTORUN_NINJA_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "change.h"
+#include "inputs.h"
+
+/*
+ * The build graph of a ninja build directory, from `ninja -t graph` for the
+ * explicit edges and `ninja -t deps` for the headers found by the compiler.
+ * Files are known by their absolute path, targets by their ninja name.
+ *
+ * Regenerating build.ninja reloads the whole graph, each build the headers
+ * found by the compiler.
+ */
+class build_graph : public input_graph {
+    public:
+        build_graph()
+            : _dir{}, _manifest{}, _deps_log{}, _nodes{}, _files{}, _marks{}, _epoch{0}
+        {
+        }
+
+        /* Load the whole graph of build_dir, returns false on error. */
+        bool load(const std::string& build_dir);
+
+        /* Reload the dependencies found by the compiler only. */
+        bool load_deps();
+
+        const std::string& dir() const
+        {
+            return _dir;
+        }
+
+        /* build.ninja, the graph is reloaded when it is regenerated */
+        const std::string& manifest() const
+        {
+            return _manifest;
+        }
+
+        /* .ninja_deps, written at the end of each build */
+        const std::string& deps_log() const
+        {
+            return _deps_log;
+        }
+
+        size_t size() const
+        {
+            return _files.size();
+        }
+
+        /* ninja -C <dir>, to which the goals are appended */
+        std::string command() const;
+
+        /* The build directory, then every directory holding a source. */
+        void input_dirs(std::vector<std::string>& dirs) const override;
+
+        bool refresh(const change_batch& batch, size_t first) override;
+
+        /*
+         * Append to goals the targets to build for the changed sources of
+         * batch: the outputs depending on them that are the input of no
+         * other build, phony ones aside. Generated files are not sources.
+         */
+        void goals(const change_batch& batch, std::vector<std::string>& goals);
+
+    private:
+        static constexpr uint32_t none = UINT32_MAX;
+
+        /* Either a file or a build edge, linked from inputs to outputs. */
+        struct node {
+            std::string name;
+            std::vector<uint32_t> next;
+            std::vector<uint32_t> deps_next;
+            uint32_t producer;
+            bool build;
+            bool phony;
+        };
+
+        uint32_t file(const std::string& name);
+        uint32_t add_build(bool phony);
+        bool parse_graph(const std::string& dot);
+        void parse_deps(const std::string& text);
+
+        std::string _dir;
+        std::string _manifest;
+        std::string _deps_log;
+        std::vector<node> _nodes;
+        std::unordered_map<std::string, uint32_t> _files;
+        std::vector<uint32_t> _marks;
+        uint32_t _epoch;
+};
+
+#endif /* AUTORUN_NINJA_H */
@@ -0,0 +1,158 @@
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+
+#include "pipeline.h"
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+
+bool pipeline_scheduler::add_stage(std::string name, const std::string& rules, std::string cmd)
+{
+    stage s{std::move(name), {}, std::move(cmd)};
+
+    if (!add_rule_list(s.rules, rules))
+        return false;
+
+    _stages.push_back(std::move(s));
+    return true;
+}
+
+bool pipeline_scheduler::start()
+{
+    _efd = epoll_create1(EPOLL_CLOEXEC);
+    if (_efd == -1) {
+        error(errno, "epoll_create1");
+        return false;
+    }
+    return true;
+}
+
+size_t pipeline_scheduler::first_affected(const change_batch& batch) const
+{
+    for (size_t s = 0; s < _stages.size(); ++s) {
+        if (_stages[s].rules.empty())
+            return s;
+
+        for (auto& c: batch) {
+            if (_stages[s].rules.match(c.path.data(), c.path.size(), c.mask & IN_ISDIR))
+                return s;
+        }
+    }
+
+    return none;
+}
+
+bool pipeline_scheduler::operator()(change_batch& batch)
+{
+    size_t s = first_affected(batch);
+
+    if (s == none)
+        return true;
+
+    if (_running == none) {
+        run(s);
+        return true;
+    }
+
+    /* later stages see the change anyway, once the running one is done */
+    if (s > _running)
+        return true;
+
+    if (_restart == none) {
+        if (kill(-_pid, SIGTERM) == -1)
+            error(errno, "kill");
+        _restart = s;
+    } else if (s < _restart) {
+        _restart = s;
+    }
+
+    return true;
+}
+
+void pipeline_scheduler::run(size_t s)
+{
+    for (; s < _stages.size(); ++s) {
+        _pid = spawn_group(_stages[s].cmd.c_str());
+        if (_pid == -1)
+            break;
+
+        _pidfd = open_pidfd(_pid);
+        if (_pidfd != -1) {
+            struct epoll_event event;
+
+            event.events = EPOLLIN;
+            event.data.fd = _pidfd;
+            if (epoll_ctl(_efd, EPOLL_CTL_ADD, _pidfd, &event) == 0) {
+                _running = s;
+                return;
+            }
+            error(errno, "epoll_ctl");
+        }
+
+        /* cannot wait asynchronously, wait here */
+        int status = reap(s);
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            break;
+    }
+
+    _running = none;
+}
+
+int pipeline_scheduler::reap(size_t s)
+{
+    int status = -1;
+
+    while (waitpid(_pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    trace(trace_kind::run, _pid, status, _stages[s].cmd);
+
+    if (_pidfd != -1) {
+        epoll_ctl(_efd, EPOLL_CTL_DEL, _pidfd, nullptr);
+        close(_pidfd);
+    }
+    _pid = -1;
+    _pidfd = -1;
+    return status;
+}
+
+bool pipeline_scheduler::on_readable()
+{
+    struct epoll_event event;
+
+    if (epoll_wait(_efd, &event, 1, 0) != 1 || _running == none)
+        return true;
+
+    size_t s = _running;
+    int status = reap(s);
+
+    _running = none;
+    if (_restart != none) {
+        s = _restart;
+        _restart = none;
+        std::clog << "autorun: " << _stages[s].name << ": restarting\n";
+        run(s);
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        run(s + 1);
+    } else {
+        std::clog << "autorun: " << _stages[s].name << ": failed, stopping\n";
+    }
+
+    return true;
+}
+
+pipeline_scheduler::~pipeline_scheduler()
+{
+    if (_running != none) {
+        kill(-_pid, SIGTERM);
+        reap(_running);
+    }
+
+    if (_efd != -1)
+        close(_efd);
+}
@@ -0,0 +1,75 @@
+#ifndef AUTORUN_PIPELINE_H
+#define AUTORUN_PIPELINE_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "change.h"
+#include "filter.h"
+
+/*
+ * Stages run one after the other, like generate, compile, then test. A
+ * change starts the pipeline from the first stage with a matching rule, a
+ * failed stage stops it. A change for a stage that is running or already
+ * done cancels the running stage (SIGTERM to its process group) and
+ * restarts the pipeline from there.
+ *
+ * Stages run asynchronously: the watcher calls on_readable() when fd() is
+ * readable, that is when the running stage exited.
+ */
+class pipeline_scheduler {
+    public:
+        pipeline_scheduler()
+            : _stages{}, _efd{-1}, _running{none}, _restart{none}, _pid{-1}, _pidfd{-1}
+        {
+        }
+
+        pipeline_scheduler(const pipeline_scheduler&) = delete;
+        pipeline_scheduler& operator=(const pipeline_scheduler&) = delete;
+
+        /*
+         * rules is a comma separated list of path rules, see path_set, an
+         * empty list matches every change. Returns false on invalid rules.
+         */
+        bool add_stage(std::string name, const std::string& rules, std::string cmd);
+
+        bool start();
+
+        int fd() const
+        {
+            return _efd;
+        }
+
+        bool operator()(change_batch& batch);
+
+        /* Reap the running stage and start the next one. */
+        bool on_readable();
+
+        ~pipeline_scheduler();
+
+    private:
+        static constexpr size_t none = SIZE_MAX;
+
+        struct stage {
+            std::string name;
+            path_set rules;
+            std::string cmd;
+        };
+
+        size_t first_affected(const change_batch& batch) const;
+        void run(size_t s);
+        int reap(size_t s);
+
+        std::vector<stage> _stages;
+        int _efd;
+        size_t _running;
+        size_t _restart;
+        pid_t _pid;
+        int _pidfd;
+};
+
+#endif /* AUTORUN_PIPELINE_H */
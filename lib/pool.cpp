@@ -0,0 +1,160 @@
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+
+bool job_pool::start()
+{
+    if (_slots.empty()) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        _slots.resize(cpus > 0 ? cpus : 1);
+    }
+
+    _efd = epoll_create1(EPOLL_CLOEXEC);
+    if (_efd == -1) {
+        error(errno, "epoll_create1");
+        return false;
+    }
+
+    /* makes fd() readable for the commands that were not waited through it */
+    _notify = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_notify == -1) {
+        error(errno, "eventfd");
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = finished_id;
+    if (epoll_ctl(_efd, EPOLL_CTL_ADD, _notify, &event) == -1) {
+        error(errno, "epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+void job_pool::submit(std::string cmd, uint64_t tag)
+{
+    _pending.emplace_back(std::move(cmd), tag);
+    dispatch();
+}
+
+void job_pool::dispatch()
+{
+    for (size_t i = 0; i < _slots.size() && !_pending.empty(); ++i) {
+        if (_slots[i].pid != -1)
+            continue;
+
+        /* one command at a time runs on the token autorun holds implicitly */
+        bool token = _server && _implicit;
+        if (token && !_server->acquire()) {
+            wait_token();
+            return;
+        }
+
+        auto next = std::move(_pending.front());
+        _pending.pop_front();
+        if (!run(i, std::move(next.first), next.second, token))
+            --i;
+    }
+}
+
+/* Make fd() readable once, when the jobserver has a token again. */
+void job_pool::wait_token()
+{
+    struct epoll_event event;
+
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = token_id;
+    if (epoll_ctl(_efd, _waiting ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, _server->fd(), &event) == -1)
+        error(errno, "epoll_ctl");
+    _waiting = true;
+}
+
+bool job_pool::run(size_t i, std::string cmd, uint64_t tag, bool token)
+{
+    slot& s = _slots[i];
+
+    s.pid = spawn_group(cmd.c_str());
+    if (s.pid == -1) {
+        if (token)
+            _server->release();
+        finished(tag, -1);
+        return false;
+    }
+
+    s.token = token;
+    _implicit = _implicit || !token;
+    s.tag = tag;
+    s.cmd = std::move(cmd);
+    _running++;
+
+    s.pidfd = open_pidfd(s.pid);
+    if (s.pidfd != -1) {
+        struct epoll_event event;
+
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        if (epoll_ctl(_efd, EPOLL_CTL_ADD, s.pidfd, &event) == 0)
+            return true;
+        error(errno, "epoll_ctl");
+    }
+
+    /* cannot wait asynchronously, wait here */
+    finished(tag, reap(s));
+    return false;
+}
+
+void job_pool::finished(uint64_t tag, int status)
+{
+    uint64_t one = 1;
+
+    _finished.emplace_back(tag, status);
+    if (write(_notify, &one, sizeof(one)) == -1)
+        error(errno, "write");
+}
+
+int job_pool::reap(slot& s)
+{
+    int status = -1;
+
+    while (waitpid(s.pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    trace(trace_kind::run, s.pid, status, s.cmd);
+
+    if (s.pidfd != -1) {
+        epoll_ctl(_efd, EPOLL_CTL_DEL, s.pidfd, nullptr);
+        close(s.pidfd);
+    }
+    s.pid = -1;
+    s.pidfd = -1;
+    _running--;
+
+    if (s.token) {
+        _server->release();
+        s.token = false;
+    } else {
+        _implicit = false;
+    }
+    return status;
+}
+
+job_pool::~job_pool()
+{
+    for (auto& s: _slots) {
+        if (s.pid == -1)
+            continue;
+        kill(-s.pid, SIGTERM);
+        reap(s);
+    }
+
+    if (_notify != -1)
+        close(_notify);
+    if (_efd != -1)
+        close(_efd);
+}
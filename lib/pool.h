@@ -0,0 +1,142 @@
+#ifndef AUTORUN_POOL_H
+#define AUTORUN_POOL_H
+
+#include <sys/epoll.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jobserver.h"
+#include "util.h"
+
+/*
+ * Run commands in parallel, at most size() at a time, the others wait in
+ * submission order. Each command carries a tag handed back once it exited:
+ * the owner calls on_readable() when fd() is readable.
+ *
+ * With a jobserver, every command but one also needs one of its tokens,
+ * held until it exits.
+ */
+class job_pool {
+    public:
+        job_pool()
+            : _slots{}, _pending{}, _finished{}, _server{nullptr}, _efd{-1}, _notify{-1},
+              _running{0}, _implicit{false}, _waiting{false}
+        {
+        }
+
+        job_pool(const job_pool&) = delete;
+        job_pool& operator=(const job_pool&) = delete;
+
+        /* Before start(), defaults to the number of online CPUs. */
+        void set_size(size_t size)
+        {
+            _slots.resize(size);
+        }
+
+        size_t size() const
+        {
+            return _slots.size();
+        }
+
+        void set_jobserver(jobserver *server)
+        {
+            _server = server;
+        }
+
+        bool start();
+
+        int fd() const
+        {
+            return _efd;
+        }
+
+        size_t running() const
+        {
+            return _running;
+        }
+
+        size_t pending() const
+        {
+            return _pending.size();
+        }
+
+        void submit(std::string cmd, uint64_t tag);
+
+        /*
+         * done(tag, status) for each command that exited, or could not be
+         * started (status -1), then start the next ones.
+         */
+        template <typename F>
+        void on_readable(F done)
+        {
+            struct epoll_event events[16];
+            int n = epoll_wait(_efd, events, 16, 0);
+
+            for (int i = 0; i < n; ++i) {
+                /* a token showed up, dispatch() below tries to take it */
+                if (events[i].data.u64 == token_id)
+                    continue;
+                if (events[i].data.u64 == finished_id) {
+                    uint64_t count;
+
+                    if (read(_notify, &count, sizeof(count)) == -1 && errno != EAGAIN)
+                        error(errno, "read");
+                    continue;
+                }
+
+                slot& s = _slots[events[i].data.u64];
+                uint64_t tag = s.tag;
+
+                done(tag, reap(s));
+            }
+
+            /* done() may submit more, and finish more */
+            while (!_finished.empty()) {
+                auto f = _finished.back();
+
+                _finished.pop_back();
+                done(f.first, f.second);
+            }
+
+            dispatch();
+        }
+
+        ~job_pool();
+
+    private:
+        struct slot {
+            pid_t pid = -1;
+            int pidfd = -1;
+            bool token = false;
+            uint64_t tag = 0;
+            std::string cmd;
+        };
+
+        static constexpr uint64_t finished_id = UINT64_MAX;
+        static constexpr uint64_t token_id = UINT64_MAX - 1;
+
+        void dispatch();
+        bool run(size_t i, std::string cmd, uint64_t tag, bool token);
+        void wait_token();
+        void finished(uint64_t tag, int status);
+        int reap(slot& s);
+
+        std::vector<slot> _slots;
+        std::deque<std::pair<std::string, uint64_t>> _pending;
+        std::vector<std::pair<uint64_t, int>> _finished;
+        jobserver *_server;
+        int _efd;
+        int _notify;
+        size_t _running;
+        bool _implicit;
+        bool _waiting;
+};
+
+#endif /* AUTORUN_POOL_H */
@@ -0,0 +1,63 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "pressure.h"
+
+static const char *const resources[] = {
+    "/proc/pressure/cpu",
+    "/proc/pressure/memory",
+    "/proc/pressure/io",
+};
+
+bool pressure_gauge::open()
+{
+    for (auto path: resources) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+        if (fd != -1)
+            _fds.push_back(fd);
+    }
+
+    if (_fds.empty()) {
+        std::cerr << "autorun: /proc/pressure: no pressure information\n";
+        return false;
+    }
+    return true;
+}
+
+/*
+ *   some avg10=4.30 avg60=1.50 avg300=3.95 total=438814937
+ *   full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ */
+double pressure_gauge::current() const
+{
+    double max = 0;
+    char buf[256];
+
+    for (int fd: _fds) {
+        ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+
+        if (len <= 0)
+            continue;
+        buf[len] = '\0';
+
+        const char *avg = std::strstr(buf, "some avg10=");
+        if (!avg)
+            continue;
+
+        double value = std::strtod(avg + std::strlen("some avg10="), nullptr);
+        if (value > max)
+            max = value;
+    }
+    return max;
+}
+
+pressure_gauge::~pressure_gauge()
+{
+    for (int fd: _fds)
+        close(fd);
+}
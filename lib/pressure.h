@@ -0,0 +1,213 @@
+#ifndef AUTORUN_PRESSURE_H
+#define AUTORUN_PRESSURE_H
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+#include "change.h"
+#include "util.h"
+
+/* The longest a change waits for the pressure to drop. */
+constexpr uint64_t pressure_max_hold = 30000000000;
+
+/*
+ * The pressure stall information of the kernel (Linux 4.20): the share of
+ * the last 10 seconds some task spent waiting on the CPU, on memory or on
+ * I/O, from /proc/pressure.
+ */
+class pressure_gauge {
+    public:
+        pressure_gauge() : _fds{}
+        {
+        }
+
+        pressure_gauge(const pressure_gauge&) = delete;
+        pressure_gauge& operator=(const pressure_gauge&) = delete;
+
+        /* Returns false, with a message, when no resource has pressure information. */
+        bool open();
+
+        /* The highest "some avg10" of the resources, in percent. */
+        double current() const;
+
+        ~pressure_gauge();
+
+    private:
+        std::vector<int> _fds;
+};
+
+/*
+ * Hold the changes while the machine is busy, then pass them all at once:
+ * while the pressure of the CPU, memory or I/O is above the limit, nothing
+ * goes through and the pressure is checked again every second. Changes are
+ * never held longer than pressure_max_hold, a command still runs on a
+ * machine that stays loaded, only later. The job_scheduler holds its
+ * background jobs only instead, this is then disabled.
+ *
+ * Disabled, with a zero limit, it passes everything through.
+ */
+template <typename Backend>
+class pressure_backend {
+    public:
+        pressure_backend()
+            : _backend{}, _gauge{}, _limit{0}, _efd{-1}, _timer_fd{-1}, _since{0}, _held{}
+        {
+        }
+
+        pressure_backend(const pressure_backend&) = delete;
+        pressure_backend& operator=(const pressure_backend&) = delete;
+
+        /* Hold the changes while the pressure is above limit percent. */
+        void set_limit(double limit)
+        {
+            _limit = limit;
+        }
+
+        Backend& inner()
+        {
+            return _backend;
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            if constexpr (has_skip<Backend>::value)
+                _backend.set_skip(dirnames);
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_dir(dirnames);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _backend.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            if (!_backend.start())
+                return false;
+            if (_limit <= 0)
+                return true;
+
+            if (!_gauge.open())
+                return false;
+
+            /* the changes of the backend, and the timer checking the pressure */
+            _efd = epoll_create1(EPOLL_CLOEXEC);
+            _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (_efd == -1 || _timer_fd == -1) {
+                error(errno, "pressure");
+                return false;
+            }
+
+            for (int fd: {_backend.fd(), _timer_fd}) {
+                struct epoll_event event;
+
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                if (epoll_ctl(_efd, EPOLL_CTL_ADD, fd, &event) == -1) {
+                    error(errno, "epoll_ctl");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        int fd()
+        {
+            return _limit > 0 ? _efd : _backend.fd();
+        }
+
+        bool read(change_batch& batch)
+        {
+            if (_limit <= 0)
+                return _backend.read(batch);
+
+            size_t first = batch.size();
+            struct epoll_event events[2];
+            int n = epoll_wait(_efd, events, 2, 0);
+            bool rc = true;
+
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd == _timer_fd) {
+                    uint64_t ticks;
+
+                    if (::read(_timer_fd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN)
+                        error(errno, "read");
+                } else {
+                    rc = _backend.read(batch);
+                }
+            }
+
+            if (_held.empty() && batch.size() == first)
+                return rc;
+
+            uint64_t now = now_ns();
+            if (_held.empty())
+                _since = now;
+
+            if (rc && now - _since < pressure_max_hold && _gauge.current() > _limit) {
+                if (_held.empty())
+                    std::clog << "autorun: under pressure, holding the changes\n";
+                for (size_t i = first; i < batch.size(); ++i)
+                    _held.push_back(batch[i]);
+                batch.resize(first);
+                /* a file written all along is held once */
+                coalesce(_held);
+                arm(true);
+            } else if (!_held.empty()) {
+                change_batch current;
+
+                for (size_t i = first; i < batch.size(); ++i)
+                    current.push_back(batch[i]);
+                batch.resize(first);
+                batch.append(_held);
+                batch.append(current);
+                arm(false);
+            }
+
+            return rc;
+        }
+
+        ~pressure_backend()
+        {
+            if (_timer_fd != -1)
+                close(_timer_fd);
+            if (_efd != -1)
+                close(_efd);
+        }
+
+    private:
+        /* Check the pressure every second while changes are held. */
+        void arm(bool on)
+        {
+            struct itimerspec its = {};
+
+            if (on) {
+                its.it_value.tv_sec = 1;
+                its.it_interval.tv_sec = 1;
+            }
+            if (timerfd_settime(_timer_fd, 0, &its, nullptr) == -1)
+                error(errno, "timerfd");
+        }
+
+        Backend _backend;
+        pressure_gauge _gauge;
+        double _limit;
+        int _efd;
+        int _timer_fd;
+        uint64_t _since;
+        change_batch _held;
+};
+
+#endif /* AUTORUN_PRESSURE_H */
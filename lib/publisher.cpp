@@ -0,0 +1,116 @@
+#include <linux/futex.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "publisher.h"
+#include "util.h"
+
+bool feed_publisher::open(const std::string& name, uint64_t capacity)
+{
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        error(errno, name);
+        return false;
+    }
+
+    /* every record fits, whatever the length of its path */
+    capacity = std::max<uint64_t>(capacity, 2 * feed_record::size(PATH_MAX));
+    capacity &= ~uint64_t{7};
+    _size = sizeof(feed_header) + capacity;
+
+    if (ftruncate(fd, _size) == -1) {
+        error(errno, "ftruncate");
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    _map = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (_map == MAP_FAILED) {
+        error(errno, "mmap");
+        _map = nullptr;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    feed_header *h = header();
+    h->version = feed_version;
+    h->capacity = capacity;
+    h->reserved.store(0);
+    h->head.store(0);
+    h->futex.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(h->magic, feed_magic, sizeof(feed_magic));
+
+    _name = name;
+    return true;
+}
+
+/*
+ * reserved announces the bytes about to be overwritten before they are,
+ * so that a reader can tell whether what it just read is still intact.
+ */
+void feed_publisher::write(uint64_t batch, const change& c)
+{
+    feed_header *h = header();
+    uint64_t head = h->head.load(std::memory_order_relaxed);
+    uint32_t len = static_cast<uint32_t>(std::min<size_t>(c.path.size(), PATH_MAX));
+    uint64_t size = feed_record::size(len);
+    uint64_t off = head % h->capacity;
+
+    if (feed_wraps(h->capacity, head)) {
+        head += h->capacity - off;
+        off = 0;
+    } else if (h->capacity - off < size) {
+        h->reserved.store(head + h->capacity - off, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        reinterpret_cast<feed_record *>(ring() + off)->mask = 0;
+        head += h->capacity - off;
+        off = 0;
+    }
+
+    h->reserved.store(head + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto r = reinterpret_cast<feed_record *>(ring() + off);
+    r->batch = batch;
+    r->ts = c.ts;
+    r->mask = c.mask ? c.mask : IN_Q_OVERFLOW;
+    r->len = len;
+    std::memcpy(r + 1, c.path.data(), len);
+    reinterpret_cast<char *>(r + 1)[len] = '\0';
+
+    h->head.store(head + size, std::memory_order_release);
+}
+
+void feed_publisher::publish(const change_batch& batch)
+{
+    if (!_map)
+        return;
+
+    _batch++;
+    for (auto& c: batch)
+        write(_batch, c);
+
+    header()->futex.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &header()->futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+feed_publisher::~feed_publisher()
+{
+    if (!_map)
+        return;
+
+    munmap(_map, _size);
+    shm_unlink(_name.c_str());
+}
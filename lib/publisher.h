@@ -0,0 +1,71 @@
+#ifndef AUTORUN_PUBLISHER_H
+#define AUTORUN_PUBLISHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "change.h"
+#include "feed.h"
+
+/* Writing side of a feed, see feed.h. */
+class feed_publisher {
+    public:
+        feed_publisher() : _name{}, _map{nullptr}, _size{0}, _batch{0}
+        {
+        }
+
+        feed_publisher(const feed_publisher&) = delete;
+        feed_publisher& operator=(const feed_publisher&) = delete;
+
+        /* Create /dev/shm/<name> with a ring of capacity bytes. */
+        bool open(const std::string& name, uint64_t capacity);
+
+        /* Append the changes of batch and wake the readers up. */
+        void publish(const change_batch& batch);
+
+        /* Removes the feed, the readers keep their mapping. */
+        ~feed_publisher();
+
+    private:
+        feed_header *header()
+        {
+            return static_cast<feed_header *>(_map);
+        }
+
+        char *ring()
+        {
+            return static_cast<char *>(_map) + sizeof(feed_header);
+        }
+
+        void write(uint64_t batch, const change& c);
+
+        std::string _name;
+        void *_map;
+        size_t _size;
+        uint64_t _batch;
+};
+
+/* Publish every batch to a feed instead of running a command. */
+class feed_scheduler {
+    public:
+        feed_scheduler() : _publisher{}
+        {
+        }
+
+        bool open(const std::string& name, uint64_t capacity)
+        {
+            return _publisher.open(name, capacity);
+        }
+
+        bool operator()(change_batch& batch)
+        {
+            _publisher.publish(batch);
+            return true;
+        }
+
+    private:
+        feed_publisher _publisher;
+};
+
+#endif /* AUTORUN_PUBLISHER_H */
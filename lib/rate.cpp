@@ -0,0 +1,221 @@
+#include <sys/inotify.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "rate.h"
+
+void timing_wheel::add(uint32_t id, uint64_t tick)
+{
+    insert({id, std::max(tick, _now + 1)});
+    _size++;
+}
+
+void timing_wheel::insert(const timer& t)
+{
+    constexpr uint64_t mask = (1 << bits) - 1;
+    uint64_t delta = t.tick - _now;
+    unsigned level = 0;
+    timer at = t;
+
+    while (level + 1 < levels && delta >> (bits * (level + 1)))
+        level++;
+
+    /* beyond the last wheel, wait for its last slot */
+    if (delta >> (bits * levels))
+        at.tick = _now + (uint64_t(1) << (bits * levels)) - 1;
+
+    _slots[(level << bits) | ((at.tick >> (bits * level)) & mask)].push_back(at);
+}
+
+void timing_wheel::advance(std::vector<uint32_t>& expired)
+{
+    constexpr uint64_t mask = (1 << bits) - 1;
+    unsigned top = 0;
+
+    _now++;
+
+    /* a wheel turned, the timers of the next slot above move down */
+    while (top + 1 < levels && !(_now & ((uint64_t(1) << (bits * (top + 1))) - 1)))
+        top++;
+
+    for (unsigned level = top; level > 0; --level) {
+        std::vector<timer> moved;
+
+        moved.swap(_slots[(level << bits) | ((_now >> (bits * level)) & mask)]);
+        for (auto& t: moved)
+            insert(t);
+    }
+
+    auto& slot = _slots[_now & mask];
+    for (auto& t: slot)
+        expired.push_back(t.id);
+    _size -= slot.size();
+    slot.clear();
+}
+
+/* 5s, 500ms, 1m, 2h, a missing number is 1 */
+static bool parse_period(const char *s, uint64_t& ns)
+{
+    char *end;
+    double value = std::strtod(s, &end);
+
+    if (end == s)
+        value = 1;
+
+    std::string unit = end;
+    if (unit == "ms")
+        value *= 1e6;
+    else if (unit == "s" || unit.empty())
+        value *= 1e9;
+    else if (unit == "m")
+        value *= 60e9;
+    else if (unit == "h")
+        value *= 3600e9;
+    else
+        return false;
+
+    ns = static_cast<uint64_t>(value);
+    return value >= 1e6;
+}
+
+bool rate_limiter::add(const std::string& spec)
+{
+    size_t slash = spec.find('/');
+    size_t colon = spec.find(':');
+    uint64_t period;
+    char *end;
+
+    if (slash == std::string::npos || slash > colon)
+        return false;
+
+    unsigned long n = std::strtoul(spec.c_str(), &end, 10);
+    if (n == 0 || end != spec.c_str() + slash)
+        return false;
+
+    if (!parse_period(spec.substr(slash + 1, colon - slash - 1).c_str(), period))
+        return false;
+
+    bucket b{spec, {}, static_cast<double>(n), period / n, static_cast<double>(n), 0, false,
+             0, false, 0, {}};
+    if (colon != std::string::npos && !add_rule_list(b.rules, spec.substr(colon + 1)))
+        return false;
+
+    _limits.push_back(std::move(b));
+    return true;
+}
+
+uint32_t rate_limiter::find(const change& c) const
+{
+    bool dir = c.mask & IN_ISDIR;
+
+    if (c.mask & IN_Q_OVERFLOW)
+        return none;
+
+    for (uint32_t i = 0; i < _limits.size(); ++i) {
+        auto& rules = _limits[i].rules;
+
+        if (rules.empty() || rules.match(c.path.data(), c.path.size(), dir))
+            return i;
+    }
+    return none;
+}
+
+bool rate_limiter::take(bucket& b, uint64_t now)
+{
+    b.tokens = std::min(b.capacity, b.tokens + static_cast<double>(now - b.last) / b.refill_ns);
+    b.last = now;
+
+    if (b.tokens < 1)
+        return false;
+    b.tokens -= 1;
+    return true;
+}
+
+/* Expire the limit when it has a token again. */
+void rate_limiter::schedule(uint32_t id, uint64_t now)
+{
+    bucket& b = _limits[id];
+
+    if (b.scheduled)
+        return;
+    if (_wheel.size() == 0)
+        _wheel.reset(now / tick_ns);
+
+    uint64_t wait = static_cast<uint64_t>((1 - b.tokens) * b.refill_ns);
+    _wheel.add(id, (now + wait + tick_ns - 1) / tick_ns);
+    b.scheduled = true;
+}
+
+void rate_limiter::expire(change_batch& batch, uint64_t now)
+{
+    uint64_t tick = now / tick_ns;
+
+    while (_wheel.size() > 0 && _wheel.now() < tick)
+        _wheel.advance(_expired);
+
+    for (uint32_t id: _expired) {
+        bucket& b = _limits[id];
+
+        b.scheduled = false;
+        if (b.held.empty())
+            continue;
+
+        if (!take(b, now)) {
+            schedule(id, now);
+            continue;
+        }
+
+        std::clog << "autorun: --max-rate " << b.spec << ": " << b.suppressed
+            << " triggers folded into this run\n";
+        batch.append(b.held);
+        b.suppressed = 0;
+    }
+    _expired.clear();
+}
+
+void rate_limiter::limit(change_batch& batch, size_t first, uint64_t now)
+{
+    size_t out = first;
+
+    /* the limits decide once per batch */
+    _epoch++;
+
+    for (size_t i = first; i < batch.size(); ++i) {
+        change& c = batch[i];
+        uint32_t id = find(c);
+
+        if (id != none) {
+            bucket& b = _limits[id];
+
+            if (b.epoch != _epoch) {
+                b.epoch = _epoch;
+                b.pass = b.held.empty() && take(b, now);
+                if (!b.pass) {
+                    b.suppressed++;
+                    schedule(id, now);
+                }
+            }
+
+            if (!b.pass) {
+                b.held.push_back(c);
+                continue;
+            }
+        }
+
+        if (out != i) {
+            batch[out].ts = c.ts;
+            batch[out].mask = c.mask;
+            batch[out].path.swap(c.path);
+        }
+        out++;
+    }
+    batch.resize(out);
+
+    /* a file written all along is held once */
+    for (auto& b: _limits) {
+        if (b.epoch == _epoch && !b.pass)
+            coalesce(b.held);
+    }
+}
@@ -0,0 +1,271 @@
+#ifndef AUTORUN_RATE_H
+#define AUTORUN_RATE_H
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+#include "change.h"
+#include "filter.h"
+#include "util.h"
+
+/*
+ * Timers counted in ticks, in wheels of 64 slots: the first wheel holds the
+ * timers of the next 64 ticks, each next one those up to 64 times further,
+ * moved down a wheel as their time gets closer. Adding a timer and moving
+ * to the next tick cost the same whatever the number of timers.
+ */
+class timing_wheel {
+    public:
+        static constexpr unsigned levels = 4;
+        static constexpr unsigned bits = 6;
+
+        timing_wheel() : _slots(levels << bits), _now{0}, _size{0}
+        {
+        }
+
+        uint64_t now() const
+        {
+            return _now;
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        /* Jump to tick, only while there is no timer. */
+        void reset(uint64_t tick)
+        {
+            _now = tick;
+        }
+
+        /* Expire id at tick, the next tick at the earliest. */
+        void add(uint32_t id, uint64_t tick);
+
+        /* Move to the next tick, appending the ids of the expired timers. */
+        void advance(std::vector<uint32_t>& expired);
+
+    private:
+        struct timer {
+            uint32_t id;
+            uint64_t tick;
+        };
+
+        void insert(const timer& t);
+
+        std::vector<std::vector<timer>> _slots;
+        uint64_t _now;
+        size_t _size;
+};
+
+/*
+ * Limit the rate of the runs caused by the changes matching some rules:
+ * each limit is a token bucket of n runs refilled over a period, so n runs
+ * may go at once then one every period / n. The changes of a batch are
+ * split by the first limit whose rules they match, others go through. When
+ * a limit has no token left, its changes are held and passed along with
+ * the first batch after a token is back.
+ */
+class rate_limiter {
+    public:
+        /* One tick of the timing wheel. */
+        static constexpr uint64_t tick_ns = 100000000;
+
+        rate_limiter() : _limits{}, _wheel{}, _expired{}, _epoch{0}
+        {
+        }
+
+        /* <n>/<period>[:<rules>], period like 5s, 500ms, 1m, returns false if invalid. */
+        bool add(const std::string& spec);
+
+        bool empty() const
+        {
+            return _limits.empty();
+        }
+
+        /* Whether changes are held, and the wheel needs to tick. */
+        bool waiting() const
+        {
+            return _wheel.size() > 0;
+        }
+
+        /* Append the held changes whose limit has a token again by now. */
+        void expire(change_batch& batch, uint64_t now);
+
+        /* Hold the changes of batch from first on over their limit. */
+        void limit(change_batch& batch, size_t first, uint64_t now);
+
+    private:
+        static constexpr uint32_t none = UINT32_MAX;
+
+        struct bucket {
+            std::string spec;
+            path_set rules;
+            double capacity;
+            uint64_t refill_ns;
+            double tokens;
+            uint64_t last;
+            bool scheduled;
+            uint64_t epoch;
+            bool pass;
+            size_t suppressed;
+            change_batch held;
+        };
+
+        uint32_t find(const change& c) const;
+        bool take(bucket& b, uint64_t now);
+        void schedule(uint32_t id, uint64_t now);
+
+        std::vector<bucket> _limits;
+        timing_wheel _wheel;
+        std::vector<uint32_t> _expired;
+        uint64_t _epoch;
+};
+
+/*
+ * Hold the changes over their rate limit, see rate_limiter. The held
+ * changes are released from a timer ticking only while some are held.
+ *
+ * Without limits, it passes everything through.
+ */
+template <typename Backend>
+class rate_backend {
+    public:
+        rate_backend() : _backend{}, _limiter{}, _efd{-1}, _timer_fd{-1}, _armed{false}
+        {
+        }
+
+        rate_backend(const rate_backend&) = delete;
+        rate_backend& operator=(const rate_backend&) = delete;
+
+        rate_limiter& limiter()
+        {
+            return _limiter;
+        }
+
+        Backend& inner()
+        {
+            return _backend;
+        }
+
+        void set_skip(const std::vector<std::string>& dirnames)
+        {
+            if constexpr (has_skip<Backend>::value)
+                _backend.set_skip(dirnames);
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_dir(dirnames);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _backend.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            if (!_backend.start())
+                return false;
+            if (_limiter.empty())
+                return true;
+
+            /* the changes of the backend, and the ticks of the timing wheel */
+            _efd = epoll_create1(EPOLL_CLOEXEC);
+            _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (_efd == -1 || _timer_fd == -1) {
+                error(errno, "max-rate");
+                return false;
+            }
+
+            for (int fd: {_backend.fd(), _timer_fd}) {
+                struct epoll_event event;
+
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                if (epoll_ctl(_efd, EPOLL_CTL_ADD, fd, &event) == -1) {
+                    error(errno, "epoll_ctl");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        int fd()
+        {
+            return _limiter.empty() ? _backend.fd() : _efd;
+        }
+
+        bool read(change_batch& batch)
+        {
+            if (_limiter.empty())
+                return _backend.read(batch);
+
+            struct epoll_event events[2];
+            int n = epoll_wait(_efd, events, 2, 0);
+            bool rc = true, changes = false;
+
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd == _timer_fd) {
+                    uint64_t ticks;
+
+                    if (::read(_timer_fd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN)
+                        error(errno, "read");
+                } else {
+                    changes = true;
+                }
+            }
+
+            /* the held changes first, they are older */
+            _limiter.expire(batch, now_ns());
+
+            size_t first = batch.size();
+            if (changes) {
+                rc = _backend.read(batch);
+                _limiter.limit(batch, first, now_ns());
+            }
+
+            arm(_limiter.waiting());
+            return rc;
+        }
+
+        ~rate_backend()
+        {
+            if (_timer_fd != -1)
+                close(_timer_fd);
+            if (_efd != -1)
+                close(_efd);
+        }
+
+    private:
+        void arm(bool on)
+        {
+            struct itimerspec its = {};
+
+            if (on == _armed)
+                return;
+            if (on) {
+                its.it_value.tv_nsec = rate_limiter::tick_ns;
+                its.it_interval.tv_nsec = rate_limiter::tick_ns;
+            }
+            if (timerfd_settime(_timer_fd, 0, &its, nullptr) == -1)
+                error(errno, "timerfd");
+            _armed = on;
+        }
+
+        Backend _backend;
+        rate_limiter _limiter;
+        int _efd;
+        int _timer_fd;
+        bool _armed;
+};
+
+#endif /* AUTORUN_RATE_H */
@@ -0,0 +1,96 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+#include "record.h"
+
+static bool get_varint(const uint8_t *& p, const uint8_t *end, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool replay_reader::open(const char *filename)
+{
+    struct stat st;
+
+    int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        error(errno, filename);
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+
+    _size = st.st_size;
+    _map = _size ? mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    auto base = static_cast<const uint8_t *>(_map);
+    if (_map == MAP_FAILED || _size < sizeof(record_magic) + sizeof(record_version)
+        || std::memcmp(base, record_magic, sizeof(record_magic))
+        || std::memcmp(base + sizeof(record_magic), &record_version,
+                       sizeof(record_version))) {
+        std::cerr << "autorun: " << filename << ": not an event recording\n";
+        if (_map != MAP_FAILED)
+            munmap(_map, _size);
+        _map = nullptr;
+        _size = 0;
+        return false;
+    }
+
+    _p = base + sizeof(record_magic) + sizeof(record_version);
+    return true;
+}
+
+bool replay_reader::next(change_batch& out)
+{
+    uint64_t len, dt, idx, mask;
+
+    while (_p && _p < end()) {
+        switch (*_p++) {
+            case record_path:
+                if (!get_varint(_p, end(), len)
+                    || len > static_cast<uint64_t>(end() - _p)) {
+                    _corrupted = true;
+                    return false;
+                }
+                _paths.emplace_back(reinterpret_cast<const char *>(_p), len);
+                _p += len;
+                break;
+            case record_event:
+                if (!get_varint(_p, end(), dt) || !get_varint(_p, end(), idx)
+                    || !get_varint(_p, end(), mask) || idx >= _paths.size()) {
+                    _corrupted = true;
+                    return false;
+                }
+                _ts += dt;
+                out.emplace(_ts, static_cast<uint32_t>(mask)).path.assign(_paths[idx]);
+                break;
+            case record_batch:
+                return true;
+            default:
+                _corrupted = true;
+                return false;
+        }
+    }
+
+    return false;
+}
+
+replay_reader::~replay_reader()
+{
+    if (_map)
+        munmap(_map, _size);
+}
@@ -0,0 +1,151 @@
+#ifndef AUTORUN_RECORD_H
+#define AUTORUN_RECORD_H
+
+#include <cerrno>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "change.h"
+#include "util.h"
+
+/*
+ * Event recordings are a header followed by a stream of tagged entries.
+ * Paths are interned the first time they are seen and events refer to them
+ * by index; timestamps are stored as deltas and every integer as a LEB128
+ * varint, so that a typical event takes 3 or 4 bytes. The file is read back
+ * in place through mmap.
+ */
+constexpr char record_magic[4] = { 'A', 'R', 'R', 'C' };
+constexpr uint32_t record_version = 1;
+
+enum record_tag : uint8_t {
+    record_path = 1,
+    record_event,
+    record_batch,
+};
+
+class recorder {
+    public:
+        recorder() : _file{}, _filename{}, _failed{false}, _paths{}, _last_ts{0}
+        {
+        }
+
+        bool open(const char *filename)
+        {
+            _filename = filename;
+            _file.open(filename, std::ios::binary | std::ios::trunc);
+            if (!_file) {
+                error(errno, filename);
+                return false;
+            }
+
+            _file.write(record_magic, sizeof(record_magic));
+            _file.write(reinterpret_cast<const char *>(&record_version),
+                        sizeof(record_version));
+            return true;
+        }
+
+        bool is_open() const
+        {
+            return _file.is_open();
+        }
+
+        void add(const change& c)
+        {
+            if (_failed)
+                return;
+
+            auto it = _paths.find(c.path);
+
+            if (it == _paths.end()) {
+                it = _paths.emplace(c.path, _paths.size()).first;
+                _file.put(record_path);
+                put_varint(c.path.size());
+                _file.write(c.path.data(), c.path.size());
+            }
+
+            _file.put(record_event);
+            put_varint(c.ts - _last_ts);
+            put_varint(it->second);
+            put_varint(c.mask);
+            _last_ts = c.ts;
+        }
+
+        /* A write error ends the recording, reported once: a full disk. */
+        void end_batch()
+        {
+            if (_failed)
+                return;
+
+            _file.put(record_batch);
+            _file.flush();
+            if (!_file) {
+                error(errno ? errno : EIO, _filename);
+                _failed = true;
+            }
+        }
+
+    private:
+        void put_varint(uint64_t v)
+        {
+            while (v >= 0x80) {
+                _file.put(static_cast<char>(v | 0x80));
+                v >>= 7;
+            }
+            _file.put(static_cast<char>(v));
+        }
+
+        std::ofstream _file;
+        std::string _filename;
+        bool _failed;
+        std::unordered_map<std::string, uint64_t> _paths;
+        uint64_t _last_ts;
+};
+
+/* Iterate over the batches of a recording, mapped in memory. */
+class replay_reader {
+    public:
+        replay_reader()
+            : _map{nullptr}, _size{0}, _p{nullptr}, _paths{}, _ts{0}, _corrupted{false}
+        {
+        }
+
+        bool open(const char *filename);
+
+        /*
+         * Append the next batch to out. Returns false at the end of the
+         * recording or if it is corrupted, see corrupted().
+         */
+        bool next(change_batch& out);
+
+        bool corrupted() const
+        {
+            return _corrupted;
+        }
+
+        /* Timestamp of the last event read */
+        uint64_t ts() const
+        {
+            return _ts;
+        }
+
+        ~replay_reader();
+
+    private:
+        const uint8_t *end() const
+        {
+            return static_cast<const uint8_t *>(_map) + _size;
+        }
+
+        void *_map;
+        size_t _size;
+        const uint8_t *_p;
+        std::vector<std::string> _paths;
+        uint64_t _ts;
+        bool _corrupted;
+};
+
+#endif /* AUTORUN_RECORD_H */
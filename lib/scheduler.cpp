@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <iostream>
+
+#include "depfile.h"
+#include "scheduler.h"
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+
+void clear_screen()
+{
+    std::cout << "\033[2J\033[1;1H";
+    std::cout.flush();
+}
+
+int run_cmd(const char *cmd)
+{
+    int rc = spawn_cmd(cmd);
+
+    trace(trace_kind::run, -1, rc);
+    return rc;
+}
+
+bool command_scheduler::select_tests(const change_batch& batch)
+{
+    for (auto& c: batch) {
+        if (absolute_path(c.path) == _map) {
+            _tests->update(_map);
+            break;
+        }
+    }
+
+    _selected.clear();
+    _tests->goals(batch, _selected);
+    if (_selected.empty())
+        return false;
+
+    size_t slot = _cmd.find("{}");
+    std::string tests;
+
+    for (auto& t: _selected)
+        append_arg(tests, t);
+
+    _line.assign(_cmd, 0, slot);
+    if (slot == std::string::npos && !_line.empty() && _line.back() != ' ')
+        _line.push_back(' ');
+    _line.append(tests);
+    if (slot != std::string::npos)
+        _line.append(_cmd, slot + 2, std::string::npos);
+    return true;
+}
+
+bool print_scheduler::start()
+{
+    /* the reader went away: stop quietly instead of dying */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* absorb the bursts of a slow reader instead of blocking the reads */
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, 1 << 20);
+
+    _buf.reserve(2 * flush_size);
+    return fcntl(STDOUT_FILENO, F_GETFL) != -1;
+}
+
+static void append_number(std::string& out, uint64_t n)
+{
+    char buf[20];
+    auto res = std::to_chars(buf, buf + sizeof(buf), n);
+
+    out.append(buf, res.ptr - buf);
+}
+
+bool print_scheduler::operator()(change_batch& batch)
+{
+    _batch++;
+
+    for (auto& c: batch) {
+        if (_format == format::ndjson) {
+            append_json(_buf, c);
+            _buf.pop_back();
+            _buf.append(",\"monotonic_ns\":");
+            append_number(_buf, c.ts);
+            _buf.append(",\"batch\":");
+            append_number(_buf, _batch);
+            _buf.append("}\n");
+        } else {
+            append_number(_buf, _batch);
+            _buf.push_back(' ');
+            append_number(_buf, c.ts);
+            _buf.push_back(' ');
+            _buf.append(change_type(c.mask));
+            _buf.push_back(' ');
+            _buf.append(c.path);
+            _buf.push_back('\0');
+        }
+
+        if (_buf.size() >= flush_size && !flush())
+            return false;
+    }
+
+    return flush();
+}
+
+bool print_scheduler::flush()
+{
+    const char *p = _buf.data();
+    size_t len = _buf.size();
+
+    while (len) {
+        ssize_t rc = write(STDOUT_FILENO, p, len);
+
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1) {
+            if (errno != EPIPE)
+                error(errno, "write");
+            return false;
+        }
+        p += rc;
+        len -= rc;
+    }
+
+    _buf.clear();
+    return true;
+}
@@ -0,0 +1,160 @@
+#ifndef AUTORUN_SCHEDULER_H
+#define AUTORUN_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "change.h"
+#include "spawner.h"
+
+class depfile_graph;
+
+void clear_screen();
+int run_cmd(const char *cmd);
+
+/*
+ * Schedulers receive the filtered and coalesced batches:
+ *
+ *   bool operator()(change_batch& batch);  false to stop the watcher
+ *
+ * and those with work of their own, like reaping the commands they started,
+ * also provide
+ *
+ *   int fd();                readable when on_readable() has work to do
+ *   bool on_readable();      false to stop the watcher
+ */
+
+/*
+ * Clear the terminal and run a shell command for every batch, through the
+ * result cache or the fork server when there is one.
+ *
+ * With a test map, only the tests covering the changed files run: they
+ * replace the {} of the command, or are appended to it, and a batch
+ * covered by no test runs nothing. The map is read again when it is part
+ * of the batch.
+ */
+class command_scheduler {
+    public:
+        void set_command(std::string cmd)
+        {
+            _cmd = std::move(cmd);
+        }
+
+        /* map is the absolute path of the depfile tests was loaded from. */
+        void set_tests(depfile_graph *tests, std::string map)
+        {
+            _tests = tests;
+            _map = std::move(map);
+        }
+
+        void set_fork_server(fork_server *server)
+        {
+            _server = server;
+        }
+
+        void set_cache(result_cache *cache)
+        {
+            _cache = cache;
+        }
+
+        bool operator()(change_batch& batch)
+        {
+            const std::string *cmd = &_cmd;
+
+            if (_cache)
+                _cache->update(batch);
+
+            if (_tests) {
+                if (!select_tests(batch))
+                    return true;
+                cmd = &_line;
+            }
+
+            clear_screen();
+
+            /* XXX what to do with rc ? */
+            if (_cache)
+                _cache->run(cmd->c_str());
+            else if (_server)
+                _server->run(cmd->c_str());
+            else
+                run_cmd(cmd->c_str());
+            return true;
+        }
+
+    private:
+        /* Build the command for the affected tests, false if there is none. */
+        bool select_tests(const change_batch& batch);
+
+        std::string _cmd;
+        fork_server *_server = nullptr;
+        result_cache *_cache = nullptr;
+        depfile_graph *_tests = nullptr;
+        std::string _map;
+        std::vector<std::string> _selected;
+        std::string _line;
+};
+
+/*
+ * Print the changes on stdout instead of running anything, one record per
+ * change, either as NDJSON:
+ *
+ *   {"path":"src/a.c","type":"modify","dir":false,"monotonic_ns":123,"batch":1}
+ *
+ * or NUL terminated: "<batch> <monotonic_ns> <type> <path>\0". Paths which
+ * are not UTF-8 are only printed as they are in the latter. Records are gathered
+ * into large writes, a batch is always flushed before the next read.
+ */
+class print_scheduler {
+    public:
+        enum class format {
+            ndjson,
+            nul,
+        };
+
+        print_scheduler() : _format{format::ndjson}, _batch{0}, _buf{}
+        {
+        }
+
+        void set_format(format f)
+        {
+            _format = f;
+        }
+
+        /* Returns false if stdout cannot be written to. */
+        bool start();
+
+        bool operator()(change_batch& batch);
+
+    private:
+        static constexpr size_t flush_size = 256 * 1024;
+
+        bool flush();
+
+        format _format;
+        uint64_t _batch;
+        std::string _buf;
+};
+
+/* Hand the batches over to a callable, for embedders. */
+template <typename F>
+class callback_scheduler {
+    public:
+        callback_scheduler(F f) : _f(std::move(f))
+        {
+        }
+
+        bool operator()(change_batch& batch)
+        {
+            return _f(batch);
+        }
+
+    private:
+        F _f;
+};
+
+#endif /* AUTORUN_SCHEDULER_H */
@@ -0,0 +1,100 @@
+#ifndef AUTORUN_SHARD_H
+#define AUTORUN_SHARD_H
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <thread>
+
+#include "change.h"
+#include "inotify.h"
+
+/*
+ * An inotify instance with its own kernel queue, drained by a dedicated
+ * thread so that a burst in one subtree cannot overflow the queue of the
+ * others. The reader signals new changes through the shared eventfd.
+ */
+class shard {
+    public:
+        shard(int notify_fd)
+            : _in{}, _thread{}, _lock{}, _queue{},
+              _notify_fd{notify_fd}, _stop_fd{eventfd(0, EFD_CLOEXEC)}
+        {
+        }
+
+        inotify& watches()
+        {
+            return _in;
+        }
+
+        void start()
+        {
+            _thread = std::thread{&shard::run, this};
+        }
+
+        /* Move the queued changes to the end of out. */
+        void take(change_batch& out)
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+
+            out.append(_queue);
+        }
+
+        ~shard()
+        {
+            if (_thread.joinable()) {
+                uint64_t one = 1;
+                if (write(_stop_fd, &one, sizeof(one)) == -1)
+                    error(errno, "write");
+                _thread.join();
+            }
+            close(_stop_fd);
+        }
+
+    private:
+        void run()
+        {
+            struct pollfd fds[2] = {
+                { _in.fd(), POLLIN, 0 },
+                { _stop_fd, POLLIN, 0 },
+            };
+            change_batch batch;
+
+            while (true) {
+                if (poll(fds, 2, -1) == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    error(errno, "poll");
+                    return;
+                }
+
+                if (fds[1].revents)
+                    return;
+
+                if (!read_changes(_in, batch)) {
+                    error(errno, "read");
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> guard{_lock};
+                    _queue.append(batch);
+                }
+
+                uint64_t one = 1;
+                if (write(_notify_fd, &one, sizeof(one)) == -1)
+                    error(errno, "write");
+            }
+        }
+
+        inotify _in;
+        std::thread _thread;
+        std::mutex _lock;
+        change_batch _queue;
+        int _notify_fd;
+        int _stop_fd;
+};
+
+#endif /* AUTORUN_SHARD_H */
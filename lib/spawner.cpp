@@ -0,0 +1,399 @@
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+
+extern char **environ;
+
+/* Run by the shell itself, there is no program of that name to execute. */
+static const char *const shell_words[] = {
+    ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue", "do", "done",
+    "elif", "else", "esac", "eval", "exec", "exit", "export", "fg", "fi", "for",
+    "function", "getopts", "hash", "if", "in", "jobs", "read", "readonly", "return",
+    "select", "set", "shift", "source", "then", "time", "times", "trap", "type",
+    "ulimit", "umask", "unalias", "unset", "until", "wait", "while",
+};
+
+bool split_simple_cmd(const char *cmd, std::vector<std::string>& argv)
+{
+    argv.clear();
+
+    for (const char *p = cmd; *p; ++p) {
+        if (*p == ' ' || *p == '\t') {
+            continue;
+        } else if (std::strchr("|&;<>()$`\\\"'*?[]#~={}!\n", *p)) {
+            return false;
+        } else if (p == cmd || p[-1] == ' ' || p[-1] == '\t') {
+            argv.emplace_back();
+        }
+        argv.back().push_back(*p);
+    }
+
+    if (argv.empty())
+        return false;
+    for (auto word: shell_words) {
+        if (argv[0] == word)
+            return false;
+    }
+    return true;
+}
+
+/* Build the argv of cmd, using /bin/sh -c only when it is needed, or asked. */
+static std::vector<char *> cmd_argv(const char *cmd, std::vector<std::string>& words,
+                                    bool shell = false)
+{
+    std::vector<char *> argv;
+
+    words.clear();
+    if (!shell && split_simple_cmd(cmd, words)) {
+        for (auto& w: words)
+            argv.push_back(&w[0]);
+    } else {
+        argv.push_back(const_cast<char *>("sh"));
+        argv.push_back(const_cast<char *>("-c"));
+        argv.push_back(const_cast<char *>(cmd));
+    }
+    argv.push_back(nullptr);
+
+    return argv;
+}
+
+static int wait_child(pid_t pid)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return status;
+}
+
+static pid_t spawn(const char *cmd, const posix_spawn_file_actions_t *actions,
+                   const posix_spawnattr_t *attr = nullptr)
+{
+    std::vector<std::string> words;
+    auto argv = cmd_argv(cmd, words);
+    const char *path = words.empty() ? "/bin/sh" : argv[0];
+    pid_t pid;
+
+    int rc = words.empty()
+        ? posix_spawn(&pid, path, actions, attr, argv.data(), environ)
+        : posix_spawnp(&pid, path, actions, attr, argv.data(), environ);
+
+    /* not a program: the shell reports it with status 127, as system() did */
+    if (rc == ENOENT && !words.empty()) {
+        argv = cmd_argv(cmd, words, true);
+        path = "/bin/sh";
+        rc = posix_spawn(&pid, path, actions, attr, argv.data(), environ);
+    }
+    if (rc) {
+        error(rc, path);
+        return -1;
+    }
+
+    return pid;
+}
+
+int spawn_cmd(const char *cmd)
+{
+    pid_t pid = spawn(cmd, nullptr);
+
+    return pid == -1 ? -1 : wait_child(pid);
+}
+
+pid_t spawn_group(const char *cmd)
+{
+    posix_spawnattr_t attr;
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    pid_t pid = spawn(cmd, nullptr, &attr);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+int open_pidfd(pid_t pid)
+{
+    int fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+
+    if (fd == -1)
+        error(errno, "pidfd_open");
+    return fd;
+}
+
+pid_t spawn_piped(const char *cmd, int& to_child, int& from_child)
+{
+    posix_spawn_file_actions_t actions;
+    int in[2], out[2];
+
+    if (pipe2(in, O_CLOEXEC) == -1) {
+        error(errno, "pipe2");
+        return -1;
+    }
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        error(errno, "pipe2");
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    /* dup2() clears O_CLOEXEC on the child side */
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+
+    pid_t pid = spawn(cmd, &actions);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+
+    if (pid == -1) {
+        close(in[1]);
+        close(out[0]);
+        return -1;
+    }
+
+    to_child = in[1];
+    from_child = out[0];
+    return pid;
+}
+
+pid_t spawn_fed(const char *cmd, int& to_child)
+{
+    posix_spawn_file_actions_t actions;
+    int in[2];
+
+    if (pipe2(in, O_CLOEXEC) == -1) {
+        error(errno, "pipe2");
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+
+    pid_t pid = spawn(cmd, &actions);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+
+    if (pid == -1) {
+        close(in[1]);
+        return -1;
+    }
+
+    to_child = in[1];
+    return pid;
+}
+
+/*
+ * Run cmd with its stdout appended to output and, with errors, its stderr
+ * appended to errors, each echoed to ours as well.
+ */
+static int capture(const char *cmd, std::string& output, std::string *errors)
+{
+    posix_spawn_file_actions_t actions;
+    char buf[65536];
+    int out[2], err[2] = {-1, -1};
+
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        error(errno, "pipe2");
+        return -1;
+    }
+    if (errors && pipe2(err, O_CLOEXEC) == -1) {
+        error(errno, "pipe2");
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    if (errors)
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+    pid_t pid = spawn(cmd, &actions);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    if (errors)
+        close(err[1]);
+
+    if (pid == -1) {
+        close(out[0]);
+        if (errors)
+            close(err[0]);
+        return -1;
+    }
+
+    struct pollfd fds[2] = {{out[0], POLLIN, 0}, {errors ? err[0] : -1, POLLIN, 0}};
+    std::string *captured[2] = {&output, errors};
+    int echo[2] = {STDOUT_FILENO, STDERR_FILENO};
+    int left = errors ? 2 : 1;
+
+    while (left) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            error(errno, "poll");
+            break;
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd == -1 || !fds[i].revents)
+                continue;
+
+            ssize_t len = read(fds[i].fd, buf, sizeof(buf));
+            if (len == -1 && errno == EINTR)
+                continue;
+            if (len <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                left--;
+                continue;
+            }
+
+            captured[i]->append(buf, len);
+            if (errors && write(echo[i], buf, len) == -1)
+                error(errno, "write");
+        }
+    }
+    for (auto& fd: fds) {
+        if (fd.fd != -1)
+            close(fd.fd);
+    }
+
+    return wait_child(pid);
+}
+
+int spawn_captured(const char *cmd, std::string& output, std::string& errors)
+{
+    return capture(cmd, output, &errors);
+}
+
+int spawn_output(const char *cmd, std::string& output)
+{
+    return capture(cmd, output, nullptr);
+}
+
+void append_arg(std::string& cmd, const std::string& arg)
+{
+    bool plain = !arg.empty();
+
+    for (char c: arg) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && !std::strchr("+,-./:@_", c))
+            plain = false;
+    }
+
+    if (!cmd.empty())
+        cmd.push_back(' ');
+    if (plain) {
+        cmd.append(arg);
+        return;
+    }
+
+    cmd.push_back('\'');
+    for (char c: arg) {
+        if (c == '\'')
+            cmd.append("'\\''");
+        else
+            cmd.push_back(c);
+    }
+    cmd.push_back('\'');
+}
+
+bool fork_server::start()
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        error(errno, "socketpair");
+        return false;
+    }
+
+    _pid = fork();
+    if (_pid == -1) {
+        error(errno, "fork");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    if (_pid == 0) {
+        close(sv[0]);
+        serve(sv[1]);
+    }
+
+    close(sv[1]);
+    _sock = sv[0];
+    return true;
+}
+
+void fork_server::serve(int sock)
+{
+    std::vector<char> cmd;
+
+    /* leave the trace and crash handlers to the main process */
+    signal(SIGUSR1, SIG_DFL);
+
+    while (true) {
+        ssize_t len = recv(sock, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR)
+                continue;
+            _exit(0);
+        }
+
+        cmd.resize(len + 1);
+        len = recv(sock, cmd.data(), len, 0);
+        if (len <= 0)
+            _exit(0);
+        cmd[len] = '\0';
+
+        /* posix_spawn does not copy even this small image, the socket is CLOEXEC */
+        pid_t pid = spawn(cmd.data(), nullptr);
+        int status = pid == -1 ? -1 : wait_child(pid);
+
+        if (send(sock, &status, sizeof(status), MSG_NOSIGNAL) == -1)
+            _exit(0);
+    }
+}
+
+int fork_server::run(const char *cmd)
+{
+    int status;
+
+    if (send(_sock, cmd, std::strlen(cmd), MSG_NOSIGNAL) == -1)
+        return -1;
+
+    ssize_t len;
+    do {
+        len = recv(_sock, &status, sizeof(status), 0);
+    } while (len == -1 && errno == EINTR);
+
+    if (len != sizeof(status))
+        return -1;
+
+    trace(trace_kind::run, _pid, status);
+    return status;
+}
+
+fork_server::~fork_server()
+{
+    if (_sock != -1)
+        close(_sock);
+    if (_pid > 0)
+        wait_child(_pid);
+}
@@ -0,0 +1,80 @@
+#ifndef AUTORUN_SPAWNER_H
+#define AUTORUN_SPAWNER_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Split cmd on blanks when it contains no shell syntax at all, nor starts
+ * with a shell builtin or keyword (cd, exit, :...), so that it can be
+ * executed without starting /bin/sh. Returns false otherwise.
+ */
+bool split_simple_cmd(const char *cmd, std::vector<std::string>& argv);
+
+/* Run cmd through posix_spawn and wait for it, returns its wait status. */
+int spawn_cmd(const char *cmd);
+
+/*
+ * Start cmd in a process group of its own, without waiting for it, so that
+ * it can be stopped along with its children. Returns its pid, or -1.
+ */
+pid_t spawn_group(const char *cmd);
+
+/* pidfd_open(2): an fd readable once pid exited, or -1. */
+int open_pidfd(pid_t pid);
+
+/*
+ * Start cmd with pipes on its stdin and stdout, without waiting for it.
+ * Returns its pid, or -1 on error.
+ */
+pid_t spawn_piped(const char *cmd, int& to_child, int& from_child);
+
+/* Start cmd with a pipe on its stdin only, without waiting for it. */
+pid_t spawn_fed(const char *cmd, int& to_child);
+
+/*
+ * Run cmd with its stdout and stderr copied to ours, and appended to output
+ * and errors. Returns its wait status.
+ */
+int spawn_captured(const char *cmd, std::string& output, std::string& errors);
+
+/* Run cmd with its stdout appended to output only. Returns its wait status. */
+int spawn_output(const char *cmd, std::string& output);
+
+/* Append arg to the shell command cmd, quoted when needed. */
+void append_arg(std::string& cmd, const std::string& arg);
+
+/*
+ * Helper process forked at startup, before the watch tables grow, which
+ * forks the commands on behalf of autorun. Requests go through a
+ * SOCK_SEQPACKET socketpair: the command line, answered by its wait status.
+ * Spawning from its small image keeps the spawn latency flat however much
+ * memory autorun uses, where posix_spawn() forks. With glibc, which does not
+ * copy the memory of the caller, it costs a round trip over spawn_cmd().
+ */
+class fork_server {
+    public:
+        fork_server() : _sock{-1}, _pid{-1}
+        {
+        }
+
+        fork_server(const fork_server&) = delete;
+        fork_server& operator=(const fork_server&) = delete;
+
+        bool start();
+
+        /* Returns the wait status of cmd, or -1 if the server is gone. */
+        int run(const char *cmd);
+
+        ~fork_server();
+
+    private:
+        [[noreturn]] static void serve(int sock);
+
+        int _sock;
+        pid_t _pid;
+};
+
+#endif /* AUTORUN_SPAWNER_H */
@@ -0,0 +1,305 @@
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "spawner.h"
+#include "tail.h"
+#include "trace.h"
+#include "util.h"
+
+/* the most moved by a single splice(), and the size asked for the pipe */
+constexpr size_t chunk_size = 1 << 20;
+
+void tail_scheduler::set_inputs(const std::vector<std::string>& dirnames,
+                                const std::vector<std::string>& filenames)
+{
+    struct stat st;
+
+    if (!dirnames.empty()) {
+        std::vector<char *> rootname;
+
+        for (auto& dir: dirnames)
+            rootname.push_back(const_cast<char *>(dir.c_str()));
+        rootname.push_back(nullptr);
+
+        FTS *root = fts_open(rootname.data(), FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+        if (!root) {
+            error(errno, "fts_open");
+            return;
+        }
+
+        while (FTSENT *file = fts_read(root)) {
+            if (file->fts_info != FTS_F)
+                continue;
+
+            add(file->fts_path, *file->fts_statp, file->fts_statp->st_size);
+        }
+        fts_close(root);
+    }
+
+    for (auto& file: filenames) {
+        if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            add(file, st, st.st_size);
+    }
+}
+
+bool tail_scheduler::start()
+{
+    /* a dead command must not take autorun down with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* with a pattern, the command only runs for the matching lines */
+    if (!_matcher.empty())
+        return true;
+
+    _pid = spawn_fed(_cmd.c_str(), _to_cmd);
+    if (_pid == -1)
+        return false;
+
+    /* fewer and larger splices, the default pipe holds 64 KiB */
+    fcntl(_to_cmd, F_SETPIPE_SZ, static_cast<int>(chunk_size));
+    return true;
+}
+
+void tail_scheduler::stop()
+{
+    int status;
+
+    if (_pid == -1)
+        return;
+
+    close(_to_cmd);
+    _to_cmd = -1;
+
+    kill(_pid, SIGTERM);
+    while (waitpid(_pid, &status, 0) == -1 && errno == EINTR)
+        ;
+
+    trace(trace_kind::run, _pid, status);
+    _pid = -1;
+}
+
+/* Move the data of f past its offset to the command, false if it is gone. */
+bool tail_scheduler::drain(const std::string& path, followed& f)
+{
+    if (f.fd == -1)
+        return true;
+
+    if (!_matcher.empty()) {
+        scan(path, f);
+        return true;
+    }
+
+    while (true) {
+        ssize_t len = splice(f.fd, &f.offset, _to_cmd, nullptr, chunk_size,
+                             SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (len > 0)
+            continue;
+        if (len == 0)
+            return true;
+        if (errno == EINTR)
+            continue;
+        if (errno == EPIPE)
+            return false;
+
+        error(errno, path);
+        return true;
+    }
+}
+
+/* Append the lines of f past its offset matching the pattern to _matched. */
+void tail_scheduler::scan(const std::string& path, followed& f)
+{
+    _buf.resize(chunk_size);
+
+    while (true) {
+        ssize_t len = pread(f.fd, _buf.data(), _buf.size(), f.offset);
+
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1)
+            error(errno, path);
+        if (len <= 0)
+            return;
+
+        const char *p = _buf.data(), *end = p + len;
+        f.offset += len;
+
+        /* complete the line left over by the previous read first */
+        if (!f.partial.empty()) {
+            auto eol = static_cast<const char *>(std::memchr(p, '\n', len));
+
+            f.partial.append(p, eol ? eol + 1 : end);
+            p = eol ? eol + 1 : end;
+
+            /* a line longer than a chunk is cut */
+            if (!eol && f.partial.size() >= chunk_size)
+                f.partial.push_back('\n');
+            if (f.partial.back() == '\n') {
+                _matcher.scan(f.partial.data(), f.partial.data() + f.partial.size(), _matched);
+                f.partial.clear();
+            }
+        }
+
+        p += _matcher.scan(p, end, _matched);
+        f.partial.append(p, end);
+    }
+}
+
+/* Run the command once with the matching lines of the batch on its stdin. */
+void tail_scheduler::run_matched()
+{
+    int to_cmd, status;
+    pid_t pid = spawn_fed(_cmd.c_str(), to_cmd);
+
+    if (pid != -1) {
+        const char *p = _matched.data();
+        size_t len = _matched.size();
+
+        /* a command which stops reading early is fine */
+        while (len) {
+            ssize_t rc = write(to_cmd, p, len);
+            if (rc == -1 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                break;
+            p += rc;
+            len -= rc;
+        }
+        close(to_cmd);
+
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+            ;
+        trace(trace_kind::run, pid, status, _cmd);
+    }
+
+    _matched.clear();
+}
+
+/*
+ * Know path as a name of the file of st, followed from offset when it is
+ * new: opened right away, a rotation in the same batch as its first write
+ * still finds it to be read to its end.
+ */
+void tail_scheduler::add(const std::string& path, const struct stat& st, loff_t offset)
+{
+    file_id id{st.st_dev, st.st_ino};
+    auto res = _files.emplace(id, followed{offset, -1, 0, {}});
+
+    if (res.second)
+        open_file(path, st, res.first->second);
+    if (_paths.emplace(path, id).second)
+        res.first->second.paths++;
+}
+
+/* Open f, the file of st at path, unless path was replaced since the stat(). */
+void tail_scheduler::open_file(const std::string& path, const struct stat& st, followed& f)
+{
+    struct stat opened;
+
+    f.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f.fd == -1) {
+        error(errno, path);
+        return;
+    }
+
+    /* replaced again since the stat(), the next change tells */
+    if (fstat(f.fd, &opened) == -1 || opened.st_ino != st.st_ino
+        || opened.st_dev != st.st_dev) {
+        close(f.fd);
+        f.fd = -1;
+    }
+}
+
+bool tail_scheduler::follow(const std::string& path)
+{
+    auto known = _paths.find(path);
+    struct stat st;
+    bool exists = stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+
+    if (known != _paths.end()
+        && (!exists || !(known->second == file_id{st.st_dev, st.st_ino}))) {
+        /* removed, renamed or replaced: what was appended before goes first */
+        followed& f = _files[known->second];
+
+        if (!drain(path, f))
+            return false;
+        if (--f.paths == 0)
+            _unlinked.push_back(known->second);
+        _paths.erase(known);
+    }
+
+    if (!exists)
+        return true;
+
+    add(path, st, 0);
+    followed& f = _files[file_id{st.st_dev, st.st_ino}];
+
+    if (st.st_size < f.offset) {
+        std::clog << "autorun: " << path << ": truncated\n";
+        f.offset = 0;
+        f.partial.clear();
+    }
+
+    if (f.fd == -1)
+        open_file(path, st, f);
+
+    return drain(path, f);
+}
+
+/* The files known by no name anymore were read to their end, and are gone. */
+void tail_scheduler::forget_unlinked()
+{
+    for (auto& id: _unlinked) {
+        auto it = _files.find(id);
+
+        if (it == _files.end() || it->second.paths > 0)
+            continue;
+        if (it->second.fd != -1)
+            close(it->second.fd);
+        _files.erase(it);
+    }
+    _unlinked.clear();
+}
+
+bool tail_scheduler::operator()(change_batch& batch)
+{
+    for (auto& c: batch) {
+        if (c.mask & (IN_ISDIR | IN_Q_OVERFLOW))
+            continue;
+
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (_pid == -1 && _matcher.empty() && !start())
+                return true;
+
+            if (follow(c.path))
+                break;
+
+            std::cerr << "autorun: tail command exited, restarting it\n";
+            stop();
+        }
+    }
+
+    forget_unlinked();
+    if (!_matched.empty())
+        run_matched();
+    return true;
+}
+
+tail_scheduler::~tail_scheduler()
+{
+    for (auto& file: _files) {
+        if (file.second.fd != -1)
+            close(file.second.fd);
+    }
+    stop();
+}
@@ -0,0 +1,115 @@
+#ifndef AUTORUN_TAIL_H
+#define AUTORUN_TAIL_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "change.h"
+#include "match.h"
+
+/*
+ * Keep the command running and move the bytes appended to the changed
+ * files into its stdin, like tail -F: nothing else is written, the data of
+ * the files follows each other as it was appended. The files present at
+ * startup are followed from their end, those created later from their
+ * start.
+ *
+ * The data goes from the page cache to the pipe with splice(), without
+ * going through autorun. Files are followed by inode: a file renamed, on
+ * rotation, is read to its end before the new one with its name, and not
+ * again under its new name. A file truncated is followed again from its
+ * start. A command that died is restarted, once per batch.
+ *
+ * With a pattern, the appended data is scanned instead, a line at a time,
+ * and the command runs for each batch adding lines that match, with these
+ * lines on its stdin. Each byte is read once: only the end of a line not
+ * complete yet is kept for the next change.
+ */
+class tail_scheduler {
+    public:
+        tail_scheduler()
+            : _cmd{}, _pid{-1}, _to_cmd{-1}, _files{}, _paths{}, _unlinked{}, _matcher{},
+              _matched{}, _buf{}
+        {
+        }
+
+        tail_scheduler(const tail_scheduler&) = delete;
+        tail_scheduler& operator=(const tail_scheduler&) = delete;
+
+        void set_command(std::string cmd)
+        {
+            _cmd = std::move(cmd);
+        }
+
+        /* Run the command for the appended lines matching pattern only. */
+        bool set_match(const std::string& pattern)
+        {
+            return _matcher.compile(pattern);
+        }
+
+        /* Skip the current content of the files below dirnames and of filenames. */
+        void set_inputs(const std::vector<std::string>& dirnames,
+                        const std::vector<std::string>& filenames);
+
+        bool start();
+
+        bool operator()(change_batch& batch);
+
+        ~tail_scheduler();
+
+    private:
+        struct file_id {
+            dev_t dev;
+            ino_t ino;
+
+            bool operator==(const file_id& other) const
+            {
+                return dev == other.dev && ino == other.ino;
+            }
+        };
+
+        struct file_id_hash {
+            size_t operator()(const file_id& id) const
+            {
+                return std::hash<uint64_t>()(id.ino ^ (static_cast<uint64_t>(id.dev) << 40));
+            }
+        };
+
+        /* A file, whatever its name, and the names it is known by. */
+        struct followed {
+            loff_t offset;
+            int fd;
+            unsigned paths;
+            /* the end of the last line, when it has no newline yet */
+            std::string partial;
+        };
+
+        void stop();
+        void add(const std::string& path, const struct stat& st, loff_t offset);
+        void open_file(const std::string& path, const struct stat& st, followed& f);
+        bool follow(const std::string& path);
+        bool drain(const std::string& path, followed& f);
+        void scan(const std::string& path, followed& f);
+        void run_matched();
+        void forget_unlinked();
+
+        std::string _cmd;
+        pid_t _pid;
+        int _to_cmd;
+        std::unordered_map<file_id, followed, file_id_hash> _files;
+        std::unordered_map<std::string, file_id> _paths;
+        /* the files which lost a name during the batch */
+        std::vector<file_id> _unlinked;
+        line_matcher _matcher;
+        std::string _matched;
+        std::vector<char> _buf;
+};
+
+#endif /* AUTORUN_TAIL_H */
@@ -0,0 +1,315 @@
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "trace.h"
+#include "util.h"
+
+constexpr size_t trace_max_threads = 64;
+
+class trace_ring {
+    public:
+        trace_ring(uint32_t nrecords)
+            : _records(new trace_record[nrecords]),
+              _arena(new char[size_t{nrecords} * 32]),
+              _nrecords{nrecords}, _arena_size{size_t{nrecords} * 32},
+              _head{0}, _name_head{0}
+        {
+        }
+
+        void push(trace_kind kind, int wd, uint32_t mask, const char *name, size_t len)
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            trace_record& rec = _records[head % _nrecords];
+
+            if (len > UINT16_MAX)
+                len = UINT16_MAX;
+            if (len > _arena_size)
+                len = _arena_size;
+
+            rec.ts = now_ns();
+            rec.wd = wd;
+            rec.mask = mask;
+            rec.name_off = _name_head;
+            rec.name_len = static_cast<uint16_t>(len);
+            rec.kind = kind;
+
+            for (size_t i = 0; i < len; ++i)
+                _arena[(_name_head + i) % _arena_size] = name[i];
+            _name_head += len;
+
+            _head.store(head + 1, std::memory_order_release);
+        }
+
+        /* Only async-signal-safe calls: this runs from the crash handler. */
+        bool dump(int fd) const
+        {
+            trace_header hdr;
+
+            std::memcpy(hdr.magic, trace_magic, sizeof(hdr.magic));
+            hdr.version = trace_version;
+            hdr.nrecords = _nrecords;
+            hdr.reserved = 0;
+            hdr.arena_size = _arena_size;
+            hdr.head = _head.load(std::memory_order_acquire);
+            hdr.name_head = _name_head;
+
+            return write_all(fd, &hdr, sizeof(hdr))
+                && write_all(fd, _records, _nrecords * sizeof(trace_record))
+                && write_all(fd, _arena, _arena_size);
+        }
+
+    private:
+        static bool write_all(int fd, const void *buf, size_t len)
+        {
+            auto p = static_cast<const char *>(buf);
+
+            while (len) {
+                ssize_t rc = write(fd, p, len);
+                if (rc == -1 && errno == EINTR)
+                    continue;
+                if (rc <= 0)
+                    return false;
+                p += rc;
+                len -= rc;
+            }
+            return true;
+        }
+
+        trace_record *_records;
+        char *_arena;
+        uint32_t _nrecords;
+        size_t _arena_size;
+        std::atomic<uint64_t> _head;
+        uint64_t _name_head;
+};
+
+static bool trace_enabled = false;
+static uint32_t trace_nrecords = 4096;
+static int trace_fd = -1;
+static std::atomic<trace_ring *> trace_rings[trace_max_threads];
+static std::atomic<size_t> trace_nrings{0};
+
+static trace_ring *trace_this_ring()
+{
+    thread_local trace_ring *ring = nullptr;
+    thread_local bool full = false;
+
+    if (!ring && !full) {
+        size_t slot = trace_nrings.fetch_add(1);
+
+        /* the threads past the last ring are not traced, nor asked again */
+        if (slot >= trace_max_threads) {
+            full = true;
+            return nullptr;
+        }
+
+        /* rings live until exit so that they can still be dumped */
+        ring = new trace_ring(trace_nrecords);
+        trace_rings[slot].store(ring, std::memory_order_release);
+    }
+    return ring;
+}
+
+void trace(trace_kind kind, int wd, uint32_t mask, const char *name, size_t len)
+{
+    if (!trace_enabled)
+        return;
+
+    if (auto ring = trace_this_ring())
+        ring->push(kind, wd, mask, name, len);
+}
+
+void trace(trace_kind kind, int wd, uint32_t mask, const std::string& name)
+{
+    trace(kind, wd, mask, name.data(), name.size());
+}
+
+void trace_dump()
+{
+    size_t n = trace_nrings.load(std::memory_order_acquire);
+
+    if (n > trace_max_threads)
+        n = trace_max_threads;
+
+    for (size_t i = 0; i < n; ++i) {
+        auto ring = trace_rings[i].load(std::memory_order_acquire);
+        if (ring)
+            ring->dump(trace_fd);
+    }
+}
+
+static void trace_on_signal(int sig)
+{
+    int saved_errno = errno;
+
+    trace_dump();
+
+    if (sig != SIGUSR1)
+        raise(sig); /* SA_RESETHAND restored the default action */
+    errno = saved_errno;
+}
+
+bool trace_start(const char *filename, uint32_t nrecords)
+{
+    struct sigaction sa;
+
+    trace_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd == -1) {
+        error(errno, filename);
+        return false;
+    }
+
+    if (nrecords)
+        trace_nrecords = nrecords;
+    trace_enabled = true;
+
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, nullptr);
+
+    sa.sa_flags = SA_RESETHAND;
+    for (int sig: { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT })
+        sigaction(sig, &sa, nullptr);
+
+    return true;
+}
+
+struct mask_name {
+    uint32_t mask;
+    const char *name;
+};
+
+constexpr mask_name inotify_masks[] = {
+    { IN_ACCESS,        "IN_ACCESS" },
+    { IN_ATTRIB,        "IN_ATTRIB" },
+    { IN_CLOSE_WRITE,   "IN_CLOSE_WRITE" },
+    { IN_CLOSE_NOWRITE, "IN_CLOSE_NOWRITE" },
+    { IN_CREATE,        "IN_CREATE" },
+    { IN_DELETE,        "IN_DELETE" },
+    { IN_DELETE_SELF,   "IN_DELETE_SELF" },
+    { IN_MODIFY,        "IN_MODIFY" },
+    { IN_MOVE_SELF,     "IN_MOVE_SELF" },
+    { IN_MOVED_FROM,    "IN_MOVED_FROM" },
+    { IN_MOVED_TO,      "IN_MOVED_TO" },
+    { IN_OPEN,          "IN_OPEN" },
+    { IN_IGNORED,       "IN_IGNORED" },
+    { IN_ISDIR,         "IN_ISDIR" },
+    { IN_Q_OVERFLOW,    "IN_Q_OVERFLOW" },
+    { IN_UNMOUNT,       "IN_UNMOUNT" },
+    { IN_ONLYDIR,       "IN_ONLYDIR" },
+    { IN_DONT_FOLLOW,   "IN_DONT_FOLLOW" },
+    { IN_EXCL_UNLINK,   "IN_EXCL_UNLINK" },
+    { IN_MASK_ADD,      "IN_MASK_ADD" },
+    { IN_ONESHOT,       "IN_ONESHOT" },
+};
+
+std::string inotify_mask2str(uint32_t mask)
+{
+    std::string str;
+
+    for (auto& m: inotify_masks) {
+        if ((mask & m.mask) == 0)
+            continue;
+        if (!str.empty())
+            str.push_back('|');
+        str.append(m.name);
+        mask &= ~m.mask;
+    }
+
+    if (mask) {
+        char unknown[16];
+        snprintf(unknown, sizeof(unknown), "0x%x", mask);
+        if (!str.empty())
+            str.push_back('|');
+        str.append(unknown);
+    }
+
+    return str;
+}
+
+static const char *trace_kind2str(trace_kind kind)
+{
+    switch (kind) {
+        case trace_kind::read:     return "read";
+        case trace_kind::event:    return "event";
+        case trace_kind::watch:    return "watch";
+        case trace_kind::traverse: return "traverse";
+        case trace_kind::run:      return "run";
+    }
+    return "unknown";
+}
+
+int trace_decode(const char *filename)
+{
+    std::ifstream file{filename, std::ios::binary};
+    trace_header hdr;
+    int ring = 0;
+
+    if (!file) {
+        error(errno, filename);
+        return 1;
+    }
+
+    while (file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr))) {
+        if (std::memcmp(hdr.magic, trace_magic, sizeof(hdr.magic))
+            || hdr.version != trace_version || hdr.nrecords == 0) {
+            std::cerr << "autorun: " << filename << ": not a trace file\n";
+            return 1;
+        }
+
+        std::vector<trace_record> records(hdr.nrecords);
+        std::vector<char> arena(hdr.arena_size);
+
+        file.read(reinterpret_cast<char *>(records.data()),
+                  records.size() * sizeof(trace_record));
+        file.read(arena.data(), arena.size());
+        if (!file) {
+            std::cerr << "autorun: " << filename << ": truncated trace\n";
+            return 1;
+        }
+
+        uint64_t first = hdr.head > hdr.nrecords ? hdr.head - hdr.nrecords : 0;
+
+        std::cout << "ring " << ring++ << ": " << hdr.head - first << " records\n";
+
+        for (uint64_t i = first; i < hdr.head; ++i) {
+            const trace_record& rec = records[i % hdr.nrecords];
+            /* the name is gone once the arena wrapped over it */
+            uint64_t age = hdr.name_head - rec.name_off;
+            bool lost = age > hdr.arena_size;
+
+            std::cout << rec.ts / 1000000000 << '.';
+            std::cout.width(9);
+            std::cout.fill('0');
+            std::cout << rec.ts % 1000000000 << ' '
+                << trace_kind2str(rec.kind) << " wd=" << rec.wd;
+
+            if (rec.kind == trace_kind::event || rec.kind == trace_kind::watch)
+                std::cout << " mask=" << inotify_mask2str(rec.mask);
+            else
+                std::cout << " value=" << static_cast<int32_t>(rec.mask);
+
+            if (rec.name_len) {
+                std::cout << " name=";
+                if (lost)
+                    std::cout << "<lost>";
+                for (uint32_t c = 0; !lost && c < rec.name_len; ++c)
+                    std::cout << arena[(rec.name_off + c) % hdr.arena_size];
+            }
+            std::cout << '\n';
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef AUTORUN_TRACE_H
+#define AUTORUN_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Tracing: every thread owns a ring of fixed-size binary records and a
+ * circular arena for the names they refer to. Nothing is formatted while
+ * running, the rings are written raw to the trace file on SIGUSR1 or when
+ * autorun crashes, and decoded offline with --decode-trace.
+ */
+enum class trace_kind : uint16_t {
+    read,
+    event,
+    watch,
+    traverse,
+    run,
+};
+
+struct trace_record {
+    uint64_t ts;
+    int32_t wd;
+    uint32_t mask;
+    uint64_t name_off;
+    uint16_t name_len;
+    trace_kind kind;
+};
+
+struct trace_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t nrecords;
+    uint32_t reserved;
+    uint64_t arena_size;
+    uint64_t head;
+    uint64_t name_head;
+};
+
+constexpr char trace_magic[4] = { 'A', 'R', 'T', 'R' };
+constexpr uint32_t trace_version = 3;
+
+void trace(trace_kind kind, int wd, uint32_t mask, const char *name = "", size_t len = 0);
+void trace(trace_kind kind, int wd, uint32_t mask, const std::string& name);
+
+/* Enable tracing, rings are dumped to filename on SIGUSR1 or on crash. */
+bool trace_start(const char *filename, uint32_t nrecords);
+void trace_dump();
+
+/* Names of every bit set in mask, separated by '|'. */
+std::string inotify_mask2str(uint32_t mask);
+
+/* Print the content of a trace file, oldest record first, one ring at a time. */
+int trace_decode(const char *filename);
+
+#endif /* AUTORUN_TRACE_H */
@@ -0,0 +1,129 @@
+#include "tree.h"
+
+uint32_t path_tree::intern(std::string_view name)
+{
+    auto off = static_cast<uint32_t>(_names.size());
+
+    _names.append(name);
+    return off;
+}
+
+uint32_t path_tree::add(uint32_t parent, std::string_view name, dev_t dev, ino_t ino, int wd)
+{
+    uint32_t n;
+
+    if (_free.empty()) {
+        n = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+    } else {
+        n = _free.back();
+        _free.pop_back();
+    }
+
+    _nodes[n] = {parent, intern(name), static_cast<uint32_t>(name.size()), 0, wd, false, dev, ino};
+    if (parent != none)
+        _nodes[parent].children++;
+    _inodes[{dev, ino}] = n;
+    return n;
+}
+
+void path_tree::move(uint32_t n, uint32_t parent, std::string_view name)
+{
+    node& node = _nodes[n];
+
+    if (node.parent != none)
+        _nodes[node.parent].children--;
+    if (parent != none)
+        _nodes[parent].children++;
+
+    _dead_bytes += node.name_len;
+    node.parent = parent;
+    node.name_off = intern(name);
+    node.name_len = static_cast<uint32_t>(name.size());
+
+    compact();
+}
+
+void path_tree::remove(uint32_t n)
+{
+    node& node = _nodes[n];
+
+    auto it = _inodes.find({node.dev, node.ino});
+    if (it != _inodes.end() && it->second == n)
+        _inodes.erase(it);
+
+    node.wd = -1;
+    node.dead = true;
+    if (!node.children)
+        release(n);
+}
+
+void path_tree::adopt(uint32_t from, uint32_t to)
+{
+    uint32_t moved = 0;
+
+    for (auto& node: _nodes) {
+        if (node.parent == from) {
+            node.parent = to;
+            moved++;
+        }
+    }
+
+    _nodes[to].children += moved;
+    _nodes[from].children = 0;
+    if (_nodes[from].dead && moved)
+        release(from);
+}
+
+void path_tree::release(uint32_t n)
+{
+    while (n != none) {
+        node& node = _nodes[n];
+        uint32_t parent = node.parent;
+
+        _dead_bytes += node.name_len;
+        node.name_len = 0;
+        /* no longer anyone's child, see adopt() */
+        node.parent = none;
+        _free.push_back(n);
+
+        if (parent == none || --_nodes[parent].children || !_nodes[parent].dead)
+            break;
+        n = parent;
+    }
+
+    compact();
+}
+
+/* Drop the names of the freed and renamed nodes once they are the majority. */
+void path_tree::compact()
+{
+    if (_dead_bytes < 4096 || _dead_bytes < _names.size() / 2)
+        return;
+
+    std::string names;
+    names.reserve(_names.size() - _dead_bytes);
+
+    for (auto& node: _nodes) {
+        auto off = static_cast<uint32_t>(names.size());
+
+        names.append(_names, node.name_off, node.name_len);
+        node.name_off = off;
+    }
+
+    _names = std::move(names);
+    _dead_bytes = 0;
+}
+
+void path_tree::append_path(uint32_t n, std::string& out)
+{
+    _stack.clear();
+    for (; n != none; n = _nodes[n].parent)
+        _stack.push_back(n);
+
+    for (auto it = _stack.rbegin(); it != _stack.rend(); ++it) {
+        if (it != _stack.rbegin())
+            out.push_back('/');
+        out.append(name(*it));
+    }
+}
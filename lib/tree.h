@@ -0,0 +1,108 @@
+#ifndef AUTORUN_TREE_H
+#define AUTORUN_TREE_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * The watched directories and files, one node per inode. A node only holds
+ * its own name, in a shared arena, and the index of its parent: paths are
+ * rebuilt on demand and renaming a directory moves its whole subtree.
+ * Roots have no parent, their name is the path they were given as.
+ */
+class path_tree {
+    public:
+        static constexpr uint32_t none = UINT32_MAX;
+
+        path_tree() : _nodes{}, _free{}, _names{}, _dead_bytes{0}, _inodes{}, _stack{}
+        {
+        }
+
+        uint32_t add(uint32_t parent, std::string_view name, dev_t dev, ino_t ino, int wd);
+
+        /* Returns none if the inode is not in the tree. */
+        uint32_t find(dev_t dev, ino_t ino) const
+        {
+            auto it = _inodes.find({dev, ino});
+            return it == _inodes.end() ? none : it->second;
+        }
+
+        void move(uint32_t n, uint32_t parent, std::string_view name);
+
+        /* Nodes with children are only freed along with their last child. */
+        void remove(uint32_t n);
+
+        /* Move the children of from under to, from is freed if removed. */
+        void adopt(uint32_t from, uint32_t to);
+
+        uint32_t parent(uint32_t n) const
+        {
+            return _nodes[n].parent;
+        }
+
+        std::string_view name(uint32_t n) const
+        {
+            return {_names.data() + _nodes[n].name_off, _nodes[n].name_len};
+        }
+
+        int wd(uint32_t n) const
+        {
+            return _nodes[n].wd;
+        }
+
+        /* Append the path of n to out. */
+        void append_path(uint32_t n, std::string& out);
+
+        size_t size() const
+        {
+            return _nodes.size() - _free.size();
+        }
+
+    private:
+        struct node {
+            uint32_t parent;
+            uint32_t name_off;
+            uint32_t name_len;
+            uint32_t children;
+            int wd;
+            bool dead;
+            dev_t dev;
+            ino_t ino;
+        };
+
+        struct inode {
+            dev_t dev;
+            ino_t ino;
+
+            bool operator==(const inode& other) const
+            {
+                return dev == other.dev && ino == other.ino;
+            }
+        };
+
+        struct inode_hash {
+            size_t operator()(const inode& i) const
+            {
+                return std::hash<uint64_t>{}(i.ino * 0x9e3779b97f4a7c15ull ^ i.dev);
+            }
+        };
+
+        uint32_t intern(std::string_view name);
+        void release(uint32_t n);
+        void compact();
+
+        std::vector<node> _nodes;
+        std::vector<uint32_t> _free;
+        std::string _names;
+        size_t _dead_bytes;
+        std::unordered_map<inode, uint32_t, inode_hash> _inodes;
+        std::vector<uint32_t> _stack;
+};
+
+#endif /* AUTORUN_TREE_H */
@@ -0,0 +1,87 @@
+#include <sys/stat.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <cstring>
+
+#include "util.h"
+
+void error(int rc, const char *msg)
+{
+    std::cerr << "autorun: " << msg << ": " << std::strerror(rc) << '\n';
+}
+
+void error(int rc, const std::string& msg)
+{
+    error(rc, msg.c_str());
+}
+
+void error(int rc, const char *msg, const char *arg)
+{
+    std::cerr << "autorun: " << msg << ' ' << arg << ": " << std::strerror(rc) << '\n';
+}
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool is_dir(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode))
+        return true;
+    else
+        return false;
+}
+
+bool is_reg(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) == 0 && S_ISREG(st.st_mode))
+        return true;
+    else
+        return false;
+}
+
+std::string normalize_path(const std::string& base, const std::string& path)
+{
+    std::string out = !path.empty() && path[0] == '/' ? "" : base;
+    size_t start = 0;
+
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+
+        size_t len = end - start;
+        if (len == 2 && path.compare(start, 2, "..") == 0) {
+            size_t slash = out.rfind('/');
+            out.resize(slash == std::string::npos ? 0 : slash);
+        } else if (len && !(len == 1 && path[start] == '.')) {
+            out.push_back('/');
+            out.append(path, start, len);
+        }
+        start = end + 1;
+    }
+
+    return out.empty() ? "/" : out;
+}
+
+std::string absolute_path(const std::string& path)
+{
+    char cwd[PATH_MAX];
+
+    if (!path.empty() && path[0] == '/')
+        return normalize_path({}, path);
+    if (!getcwd(cwd, sizeof(cwd)))
+        return normalize_path("/", path);
+    return normalize_path(cwd, path);
+}
@@ -0,0 +1,23 @@
+#ifndef AUTORUN_UTIL_H
+#define AUTORUN_UTIL_H
+
+#include <cstdint>
+#include <string>
+
+void error(int rc, const char *msg);
+void error(int rc, const std::string& msg);
+void error(int rc, const char *msg, const char *arg);
+
+/* CLOCK_MONOTONIC, in nanoseconds */
+uint64_t now_ns();
+
+bool is_dir(const char *filename);
+bool is_reg(const char *filename);
+
+/* Make path absolute, relative to base, and drop the ".", ".." and "//". */
+std::string normalize_path(const std::string& base, const std::string& path);
+
+/* normalize_path() relative to the current directory. */
+std::string absolute_path(const std::string& path);
+
+#endif /* AUTORUN_UTIL_H */
@@ -0,0 +1,141 @@
+#ifndef AUTORUN_WATCHER_H
+#define AUTORUN_WATCHER_H
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "backend.h"
+#include "change.h"
+#include "epoll.h"
+#include "filter.h"
+#include "scheduler.h"
+
+/* Schedulers running commands asynchronously have an fd of their own. */
+template <typename Scheduler, typename = void>
+struct has_fd : std::false_type {
+};
+
+template <typename Scheduler>
+struct has_fd<Scheduler, std::void_t<decltype(std::declval<Scheduler&>().fd())>>
+    : std::true_type {
+};
+
+/*
+ * The Backend produces changes, the Filter drops the unwanted ones and the
+ * Scheduler acts on the rest, once they are coalesced. The policies are
+ * chosen at compile time so that the whole path from the backend read() to
+ * the scheduler can be inlined.
+ *
+ * run() drives the watcher with its own epoll loop. Embedders with a loop of
+ * their own call start(), then on_readable() whenever fd() is readable.
+ */
+template <typename Backend, typename Filter = accept_all,
+          typename Scheduler = command_scheduler>
+class watcher {
+    public:
+        watcher() : _backend{}, _filter{}, _scheduler{}, _batch{}
+        {
+            _batch.reserve(batch_capacity);
+        }
+
+        explicit watcher(Scheduler scheduler)
+            : _backend{}, _filter{}, _scheduler{std::move(scheduler)}, _batch{}
+        {
+            _batch.reserve(batch_capacity);
+        }
+
+        Backend& backend()
+        {
+            return _backend;
+        }
+
+        Filter& filter()
+        {
+            return _filter;
+        }
+
+        Scheduler& scheduler()
+        {
+            return _scheduler;
+        }
+
+        bool watch_dir(const std::vector<std::string>& dirnames)
+        {
+            return _backend.watch_dir(dirnames);
+        }
+
+        bool watch_file(const std::vector<std::string>& filenames)
+        {
+            return _backend.watch_file(filenames);
+        }
+
+        bool start()
+        {
+            return _backend.start();
+        }
+
+        int fd()
+        {
+            return _backend.fd();
+        }
+
+        /* Returns false when the watcher should stop. */
+        bool on_readable()
+        {
+            _batch.clear();
+            if (!_backend.read(_batch))
+                return false;
+
+            return process(_batch);
+        }
+
+        bool process(change_batch& batch)
+        {
+            batch.erase(std::remove_if(batch.begin(), batch.end(),
+                                       [this](const change& c) { return !_filter(c); }),
+                        batch.end());
+            if (batch.empty())
+                return true;
+
+            coalesce(batch);
+            return _scheduler(batch);
+        }
+
+        /* Run until the backend or the scheduler asks to stop. */
+        void run()
+        {
+            epoll ep;
+
+            if (!start() || !ep.add(fd()))
+                return;
+
+            if constexpr (has_fd<Scheduler>::value) {
+                if (!ep.add(_scheduler.fd()))
+                    return;
+            }
+
+            ep.wait([this](struct epoll_event *e) -> bool {
+                if (e->data.fd == fd())
+                    return on_readable();
+                if constexpr (has_fd<Scheduler>::value) {
+                    if (e->data.fd == _scheduler.fd())
+                        return _scheduler.on_readable();
+                }
+                return true;
+            });
+        }
+
+    private:
+        /* enough for a full read of the inotify backend */
+        static constexpr size_t batch_capacity = 4096;
+
+        Backend _backend;
+        Filter _filter;
+        Scheduler _scheduler;
+        change_batch _batch;
+};
+
+#endif /* AUTORUN_WATCHER_H */
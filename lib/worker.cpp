@@ -0,0 +1,121 @@
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+#include "worker.h"
+
+/* how long a worker has to finish its batch once its stdin is closed */
+constexpr int stop_grace_ms = 2000;
+
+bool worker_scheduler::start()
+{
+    /* a dead worker must not take autorun down with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    _pid = spawn_piped(_cmd.c_str(), _to_worker, _from_worker);
+    _pending.clear();
+    return _pid != -1;
+}
+
+void worker_scheduler::stop()
+{
+    int status;
+
+    if (_pid == -1)
+        return;
+
+    close(_to_worker);
+    close(_from_worker);
+    _to_worker = _from_worker = -1;
+
+    /* closing its stdin is the polite way, it may be stuck though */
+    int pidfd = open_pidfd(_pid);
+    if (pidfd != -1) {
+        struct pollfd exited = {pidfd, POLLIN, 0};
+
+        while (poll(&exited, 1, stop_grace_ms) == -1 && errno == EINTR)
+            ;
+        close(pidfd);
+    }
+    kill(_pid, SIGTERM);
+    while (waitpid(_pid, &status, 0) == -1 && errno == EINTR)
+        ;
+
+    trace(trace_kind::run, _pid, status);
+    _pid = -1;
+}
+
+bool worker_scheduler::send()
+{
+    const char *p = _msg.data();
+    size_t len = _msg.size();
+
+    while (len) {
+        ssize_t rc = write(_to_worker, p, len);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        p += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+bool worker_scheduler::wait_reply()
+{
+    char buf[4096];
+
+    while (true) {
+        auto eol = _pending.find('\n');
+        if (eol != std::string::npos) {
+            _pending.erase(0, eol + 1);
+            return true;
+        }
+
+        ssize_t rc = read(_from_worker, buf, sizeof(buf));
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        _pending.append(buf, rc);
+    }
+}
+
+bool worker_scheduler::operator()(change_batch& batch)
+{
+    _msg.assign("{\"batch\":");
+    _msg.append(std::to_string(++_nbatch));
+    _msg.append(",\"changes\":[");
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (i)
+            _msg.push_back(',');
+        append_json(_msg, batch[i]);
+    }
+    _msg.append("]}\n");
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (_pid == -1 && !start())
+            return true;
+
+        if (send() && wait_reply())
+            return true;
+
+        std::cerr << "autorun: worker exited, restarting it\n";
+        stop();
+    }
+
+    return true;
+}
+
+worker_scheduler::~worker_scheduler()
+{
+    stop();
+}
@@ -0,0 +1,59 @@
+#ifndef AUTORUN_WORKER_H
+#define AUTORUN_WORKER_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "change.h"
+
+/*
+ * Keep the command running and stream it the batches on its stdin, one
+ * NDJSON line each:
+ *
+ *   {"batch":1,"changes":[{"path":"src/a.c","type":"modify","dir":false}]}
+ *
+ * then wait for it to answer with a line on its stdout before sending the
+ * next one. Anything else the worker wants to print goes to its stderr. A
+ * worker that died is restarted and the batch sent again, once.
+ */
+class worker_scheduler {
+    public:
+        worker_scheduler()
+            : _cmd{}, _pid{-1}, _to_worker{-1}, _from_worker{-1}, _nbatch{0},
+              _msg{}, _pending{}
+        {
+        }
+
+        worker_scheduler(const worker_scheduler&) = delete;
+        worker_scheduler& operator=(const worker_scheduler&) = delete;
+
+        void set_command(std::string cmd)
+        {
+            _cmd = std::move(cmd);
+        }
+
+        /* Start the worker ahead of the first batch, so that it can boot. */
+        bool start();
+
+        bool operator()(change_batch& batch);
+
+        ~worker_scheduler();
+
+    private:
+        void stop();
+        bool send();
+        bool wait_reply();
+
+        std::string _cmd;
+        pid_t _pid;
+        int _to_worker;
+        int _from_worker;
+        uint64_t _nbatch;
+        std::string _msg;
+        std::string _pending;
+};
+
+#endif /* AUTORUN_WORKER_H */
@@ -0,0 +1,67 @@
+/*
+ * The coroutine interface, built as C++20: a task sleeps, then writes a
+ * file the consumer gets in its next batch. A second awaiter on the same
+ * watcher resumes at once, stopped, instead of taking the place of the
+ * first one. Exits with an error otherwise.
+ *
+ *   coro-test
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "backend.h"
+#include "coro.h"
+
+using test_watcher = async_watcher<coro_loop, inotify_backend>;
+
+static std::string received;
+static bool second_stopped = false;
+
+static watch_task consume(test_watcher& w)
+{
+    std::span<change> batch = co_await w.next_batch();
+
+    for (auto& c: batch)
+        received += c.path;
+}
+
+static watch_task second(test_watcher& w)
+{
+    std::span<change> batch = co_await w.next_batch();
+
+    second_stopped = batch.empty();
+}
+
+static watch_task write_later(coro_loop& loop, std::string path)
+{
+    co_await loop.sleep(50000000);
+
+    if (FILE *f = std::fopen(path.c_str(), "w"))
+        std::fclose(f);
+}
+
+int main()
+{
+    char dir[] = "/tmp/coro-test.XXXXXX";
+    coro_loop loop;
+    test_watcher w{loop};
+
+    if (!mkdtemp(dir) || !w.watch_dir({dir}) || !w.start())
+        return 1;
+
+    consume(w);
+    second(w);
+    write_later(loop, std::string{dir} + "/new");
+    loop.run();
+
+    std::remove((std::string{dir} + "/new").c_str());
+    std::remove(dir);
+
+    if (!second_stopped || received != std::string{dir} + "/new") {
+        std::fprintf(stderr, "coro: received '%s', second awaiter %s\n", received.c_str(),
+                     second_stopped ? "stopped" : "waiting");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * The literal prefilter of line_matcher must not change what matches: each
+ * pattern of the table scans the same lines as regexec() alone would keep.
+ * Exits with an error on the first difference.
+ *
+ *   match-test
+ */
+#include <regex.h>
+
+#include <cstdio>
+#include <string>
+
+#include "match.h"
+
+static const char *patterns[] = {
+    "ERROR",
+    "ERROR|FATAL",
+    "ERR(OR)?",
+    "^warn",
+    "disk [0-9]+% full",
+    "[[:digit:]]x",
+    "[^[:space:]]+ failed",
+    "[[=e=]]rror",
+    "[[.-.]]-x",
+    "[]]x",
+    "[^]]x",
+    "a\\.b",
+    "ab?c",
+    "ab*c",
+    "ab{2}c",
+    "x{0,1}yz",
+    "(foo|bar)baz",
+    "foo|(bar)",
+    "\\bword\\b",
+    ".*",
+};
+
+static const char *lines[] = {
+    "ERROR: boom",
+    "a FATAL one",
+    "ERR only",
+    "warning: x",
+    "disk 95% full",
+    "5x",
+    "ax",
+    "job failed",
+    "error",
+    "--x",
+    "]x",
+    "yx",
+    "a.b",
+    "aXb",
+    "ac",
+    "abbc",
+    "yz",
+    "foobaz",
+    "barbaz",
+    "bar",
+    "a word here",
+    "",
+};
+
+int main()
+{
+    std::string text, scanned, expected;
+
+    for (auto line: lines) {
+        text += line;
+        text += '\n';
+    }
+
+    for (auto pattern: patterns) {
+        line_matcher matcher;
+        regex_t re;
+
+        if (!matcher.compile(pattern)
+            || regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB | REG_NEWLINE))
+            return 1;
+
+        scanned.clear();
+        matcher.scan(text.data(), text.data() + text.size(), scanned);
+
+        expected.clear();
+        for (auto line: lines) {
+            if (regexec(&re, line, 0, nullptr, 0) == 0) {
+                expected += line;
+                expected += '\n';
+            }
+        }
+        regfree(&re);
+
+        if (scanned != expected) {
+            std::fprintf(stderr, "%s: scanned\n%sinstead of\n%s", pattern, scanned.c_str(),
+                         expected.c_str());
+            return 1;
+        }
+    }
+
+    return 0;
+}